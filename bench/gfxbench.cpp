@@ -0,0 +1,154 @@
+// Host benchmark of the rendering code. src/vga.c and src/terminal.cpp are
+// built unchanged against bench/shim.c, whose mailbox hands out a framebuffer
+// in ordinary memory, so the numbers track the code rather than the Pi's
+// memory bus. Every test runs for a fixed time at each depth and prints one
+// CSV row: test,bpp,value,unit.
+
+#include "terminal.h"
+
+extern "C"
+{
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vga.h"
+
+u32 bench_clock_us(void);
+}
+
+#define BENCH_USEC		250000		// time spent on each test
+#define BENCH_WIDTH		640			// the boot mode
+#define BENCH_HEIGHT	400
+#define BENCH_SHAPES	1024		// random shapes drawn in turn
+
+unsigned char Keyboard::GetChar()
+{
+	return 0;
+}
+
+static int shapes[BENCH_SHAPES][4];
+static const char text[] = "The quick brown fox jumps over the lazy dog 0123456789\n";
+
+static u32 bench_random(u32 *seed, u32 range)
+{
+	*seed = (*seed * 1103515245) + 12345;
+	return ((*seed >> 8) % range);
+}
+
+// Each test does one unit of work for call n and returns how much it did
+typedef double (*bench_fn)(u32 n);
+
+static double test_putchar(u32 n)
+{
+	for (const char *p = text; *p; p++)
+		term_putchar(*p);
+	return sizeof(text) - 1;
+}
+
+static double test_scroll(u32 n)
+{
+	vga_scroll(1);
+	return 1;
+}
+
+static double test_clear(u32 n)
+{
+	vga_setbackcolor(VGA_INDEXED(n & 15));
+	vga_clear();
+	return (double)vga_width * vga_height;
+}
+
+static double test_fill(u32 n)
+{
+	int *s = shapes[n % BENCH_SHAPES];
+	vga_setforecolor(VGA_INDEXED(n & 15));
+	vga_fillrect(s[0], s[1], s[2], s[3]);
+	return (double)s[2] * s[3];
+}
+
+static double test_line(u32 n)
+{
+	int *s = shapes[n % BENCH_SHAPES];
+	vga_setforecolor(VGA_INDEXED(n & 15));
+	vga_drawline(s[0], s[1], s[0] + s[2], s[1] + s[3]);
+	return (s[2] > s[3] ? s[2] : s[3]) + 1;
+}
+
+static double test_circle(u32 n)
+{
+	int *s = shapes[n % BENCH_SHAPES];
+	int r = (s[2] < s[3] ? s[2] : s[3]) / 2;
+	vga_setforecolor(VGA_INDEXED(n & 15));
+	vga_fillcircle(s[0] + r, s[1] + r, r);
+	return 3.14159265 * r * r;
+}
+
+static double test_drawchar(u32 n)
+{
+	u32 cols = vga_width / vga_font_width;
+	u32 rows = vga_height / vga_font_height;
+	u32 cell = n % (cols * rows);
+	vga_drawchar((cell % cols) * vga_font_width, (cell / cols) * vga_font_height, 32 + (n % 95));
+	return 1;
+}
+
+static void bench(const char *name, bench_fn fn, double scale, const char *unit)
+{
+	double work = 0;
+	u32 n = 0;
+	u32 start = bench_clock_us();
+	u32 elapsed;
+
+	do
+	{
+		// check the clock every few calls so reading it costs little
+		for (u32 i = 0; i < 16; i++)
+			work += fn(n++);
+		elapsed = bench_clock_us() - start;
+	}
+	while (elapsed < BENCH_USEC);
+
+	// staged terminal output has to reach the framebuffer to count
+	term_flush();
+	elapsed = bench_clock_us() - start;
+
+	printf("%s,%u,%.0f,%s\n", name, vga_bpp, work * 1000000.0 / elapsed / scale, unit);
+}
+
+int main(int argc, char **argv)
+{
+	static const u32 depths[] = { 8, 16, 24, 32 };
+	u32 seed = 1;
+
+	for (u32 i = 0; i < BENCH_SHAPES; i++)
+	{
+		shapes[i][0] = bench_random(&seed, BENCH_WIDTH / 2);
+		shapes[i][1] = bench_random(&seed, BENCH_HEIGHT / 2);
+		shapes[i][2] = 1 + bench_random(&seed, BENCH_WIDTH / 2);
+		shapes[i][3] = 1 + bench_random(&seed, BENCH_HEIGHT / 2);
+	}
+
+	vga_init(BENCH_WIDTH, BENCH_HEIGHT, depths[0]);
+	term_init(0);
+
+	printf("test,bpp,value,unit\n");
+	for (u32 d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+	{
+		if (!vga_setmode(BENCH_WIDTH, BENCH_HEIGHT, depths[d]))
+		{
+			fprintf(stderr, "no %ubpp mode\n", depths[d]);
+			return 1;
+		}
+		term_layout();
+
+		bench("putchar", test_putchar, 1, "chars/s");
+		bench("scroll", test_scroll, 1, "lines/s");
+		bench("clear", test_clear, 1000000, "Mpixel/s");
+		bench("fill", test_fill, 1000000, "Mpixel/s");
+		bench("line", test_line, 1000000, "Mpixel/s");
+		bench("circle", test_circle, 1000000, "Mpixel/s");
+		bench("drawchar", test_drawchar, 1, "glyphs/s");
+	}
+
+	return 0;
+}
@@ -0,0 +1,477 @@
+// Host test of the drawing primitives in src/vga.c, built against
+// bench/shim.c like gfxbench. Random shapes, partly or wholly off screen,
+// are drawn both by vga.c and by plain unclipped reference code into a
+// second buffer in the same pixel format, and the two have to match byte for
+// byte after every shape. Flood fills are checked against a breadth-first
+// fill and polygons against an even-odd test of each pixel. Prints one line
+// per test and depth and exits with 1 on the first mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vga.h"
+
+#define TEST_WIDTH		320			// the smallest mode keeps comparing cheap
+#define TEST_HEIGHT		200
+#define TEST_LINES		20000
+#define TEST_RECTS		3000
+#define TEST_CIRCLES	3000
+#define TEST_MAXRADIUS	400
+#define TEST_RESET		64			// shapes drawn over each other before clearing
+#define TEST_FILLS		500
+#define TEST_CLUTTER	24			// lines and circles a flood fill has to find its way round
+#define TEST_POLYS		2000
+#define TEST_MAXSIDES	12
+
+static u8 *expect;
+static u32 expect_pixel;
+static u32 test_seed = 1;
+
+static int test_random(int lo, int hi)
+{
+	test_seed = (test_seed * 1103515245) + 12345;
+	return lo + (int)((test_seed >> 8) % (u32)(hi - lo + 1));
+}
+
+// the reference store, in the layout vga_getpixel reads back
+static void ref_plot(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= (int)vga_width || y >= (int)vga_height)
+		return;
+
+	u8 *dst = &expect[(x * (vga_bpp >> 3)) + (y * vga_pitch)];
+	switch (vga_bpp)
+	{
+		case 32:
+			*(u32*)dst = expect_pixel;
+			break;
+		case 24:
+			dst[0] = expect_pixel >> 16;
+			dst[1] = expect_pixel >> 8;
+			dst[2] = expect_pixel;
+			break;
+		case 8:
+			*dst = expect_pixel;
+			break;
+		default:
+			*(u16*)dst = expect_pixel;
+			break;
+	}
+}
+
+static u32 ref_getpixel(int x, int y)
+{
+	u8 *src = &expect[(x * (vga_bpp >> 3)) + (y * vga_pitch)];
+	switch (vga_bpp)
+	{
+		case 32:
+			return *(u32*)src;
+		case 24:
+			return (src[0] << 16) | (src[1] << 8) | src[2];
+		case 8:
+			return *src;
+		default:
+			return *(u16*)src;
+	}
+}
+
+// Textbook Bresenham over the whole line, with no clipping
+static void ref_line(int x1, int y1, int x2, int y2)
+{
+	int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+	int dy = abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+
+	if (dx >= dy)
+	{
+		for (int err = 2 * dy - dx;; x1 += sx)
+		{
+			ref_plot(x1, y1);
+			if (x1 == x2)
+				break;
+			if (err > 0)
+			{
+				y1 += sy;
+				err -= 2 * dx;
+			}
+			err += 2 * dy;
+		}
+	}
+	else
+	{
+		for (int err = 2 * dx - dy;; y1 += sy)
+		{
+			ref_plot(x1, y1);
+			if (y1 == y2)
+				break;
+			if (err > 0)
+			{
+				x1 += sx;
+				err -= 2 * dy;
+			}
+			err += 2 * dx;
+		}
+	}
+}
+
+static void ref_fillrect(int x0, int y0, int w, int h)
+{
+	for (int y = y0; y <= y0 + h; y++)
+		for (int x = x0; x <= x0 + w; x++)
+			ref_plot(x, y);
+}
+
+// Midpoint circle outline. Each point also widens its row in halfwidth, so a
+// filled circle is every row of the outline joined up.
+static int halfwidth[2 * TEST_MAXRADIUS + 1];
+
+static void ref_circlepoint(int x0, int y0, int dx, int dy, int fill)
+{
+	if (!fill)
+		ref_plot(x0 + dx, y0 + dy);
+	if (abs(dx) > halfwidth[dy + TEST_MAXRADIUS])
+		halfwidth[dy + TEST_MAXRADIUS] = abs(dx);
+}
+
+static void ref_circle(int x0, int y0, int r, int fill)
+{
+	int x = r, y = 0, err = 1 - r;
+
+	for (int i = -r; i <= r; i++)
+		halfwidth[i + TEST_MAXRADIUS] = -1;
+
+	for (; x >= y; y++)
+	{
+		ref_circlepoint(x0, y0, -y, -x, fill);
+		ref_circlepoint(x0, y0, y, -x, fill);
+		ref_circlepoint(x0, y0, -x, -y, fill);
+		ref_circlepoint(x0, y0, x, -y, fill);
+		ref_circlepoint(x0, y0, -x, y, fill);
+		ref_circlepoint(x0, y0, x, y, fill);
+		ref_circlepoint(x0, y0, -y, x, fill);
+		ref_circlepoint(x0, y0, y, x, fill);
+
+		if (err < 0)
+			err += 2 * (y + 1) + 1;
+		else
+		{
+			x--;
+			err += 2 * (y + 1 - x + 1);
+		}
+	}
+
+	if (fill)
+		for (int i = -r; i <= r; i++)
+			for (int dx = -halfwidth[i + TEST_MAXRADIUS]; dx <= halfwidth[i + TEST_MAXRADIUS]; dx++)
+				ref_plot(x0 + dx, y0 + i);
+}
+
+// The framebuffer has to equal the reference; reports the first difference
+static int compare(const char *name, int shape)
+{
+	if (memcmp(vga_framebuffer, expect, vga_height * vga_pitch) == 0)
+		return 1;
+
+	for (u32 y = 0; y < vga_height; y++)
+		for (u32 x = 0; x < vga_width; x++)
+		{
+			u32 got = vga_getpixel(x, y);
+			u32 want = ref_getpixel(x, y);
+
+			if (got != want)
+			{
+				printf("%s,%u: shape %d differs at %u,%u (%x, expected %x)\n", name, vga_bpp, shape, x, y, got, want);
+				return 0;
+			}
+		}
+
+	return 0;
+}
+
+// Picks the colour for shape n, clearing both buffers every TEST_RESET shapes
+static void next_shape(int n)
+{
+	if (n % TEST_RESET == 0)
+	{
+		memset(vga_framebuffer, 0, vga_height * vga_pitch);
+		memset(expect, 0, vga_height * vga_pitch);
+	}
+
+	RGBA colour = VGA_INDEXED(1 + (n % 15));
+	vga_setforecolor(colour);
+	expect_pixel = vga_pixelvalue(colour);
+}
+
+static int test_lines(void)
+{
+	for (int n = 0; n < TEST_LINES; n++)
+	{
+		int x1 = test_random(-TEST_WIDTH, 2 * TEST_WIDTH);
+		int y1 = test_random(-TEST_HEIGHT, 2 * TEST_HEIGHT);
+		int x2 = test_random(-TEST_WIDTH, 2 * TEST_WIDTH);
+		int y2 = test_random(-TEST_HEIGHT, 2 * TEST_HEIGHT);
+
+		// a few horizontal, vertical and single pixel lines
+		if (n % 16 == 1)
+			y2 = y1;
+		else if (n % 16 == 2)
+			x2 = x1;
+		else if (n % 16 == 3)
+		{
+			x2 = x1;
+			y2 = y1;
+		}
+
+		next_shape(n);
+		vga_drawline(x1, y1, x2, y2);
+		ref_line(x1, y1, x2, y2);
+		if (!compare("line", n))
+			return 0;
+	}
+	return 1;
+}
+
+static int test_rects(void)
+{
+	for (int n = 0; n < TEST_RECTS; n++)
+	{
+		int x = test_random(-TEST_WIDTH, TEST_WIDTH + 8);
+		int y = test_random(-TEST_HEIGHT, TEST_HEIGHT + 8);
+		int w = test_random(-2, 2 * TEST_WIDTH);
+		int h = test_random(-2, 2 * TEST_HEIGHT);
+
+		next_shape(n);
+		vga_fillrect(x, y, w, h);
+		ref_fillrect(x, y, w, h);
+		if (!compare("fillrect", n))
+			return 0;
+
+		// the outline, which only makes sense the right way round
+		if (w >= 0 && h >= 0)
+		{
+			next_shape(n + 1);
+			vga_drawrect(x, y, w, h);
+			ref_line(x, y, x + w, y);
+			ref_line(x, y + h, x + w, y + h);
+			ref_line(x, y, x, y + h);
+			ref_line(x + w, y, x + w, y + h);
+			if (!compare("drawrect", n))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int test_circles(void)
+{
+	for (int n = 0; n < TEST_CIRCLES; n++)
+	{
+		int x = test_random(-TEST_WIDTH / 2, TEST_WIDTH * 3 / 2);
+		int y = test_random(-TEST_HEIGHT / 2, TEST_HEIGHT * 3 / 2);
+		int r = n % 8 == 0 ? test_random(0, 3) : test_random(0, TEST_MAXRADIUS);
+
+		next_shape(n);
+		vga_drawcircle(x, y, r);
+		ref_circle(x, y, r, 0);
+		if (!compare("circle", n))
+			return 0;
+
+		next_shape(n + 1);
+		vga_fillcircle(x, y, r);
+		ref_circle(x, y, r, 1);
+		if (!compare("fillcircle", n))
+			return 0;
+	}
+	return 1;
+}
+
+// 4-connected breadth-first fill of the reference from x,y
+static int fillqueue[TEST_WIDTH * TEST_HEIGHT];
+
+static void ref_floodfill(int x, int y)
+{
+	u32 old = ref_getpixel(x, y);
+	int head = 0, tail = 0;
+
+	if (old == expect_pixel)
+		return;
+
+	ref_plot(x, y);
+	fillqueue[tail++] = (y * vga_width) + x;
+	while (head < tail)
+	{
+		static const int step[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+		int px = fillqueue[head] % vga_width;
+		int py = fillqueue[head++] / vga_width;
+
+		for (int i = 0; i < 4; i++)
+		{
+			int nx = px + step[i][0], ny = py + step[i][1];
+			if (nx >= 0 && ny >= 0 && nx < (int)vga_width && ny < (int)vga_height && ref_getpixel(nx, ny) == old)
+			{
+				ref_plot(nx, ny);
+				fillqueue[tail++] = (ny * vga_width) + nx;
+			}
+		}
+	}
+}
+
+// Pixel x,y is inside if an odd number of edges cross its row at or left of
+// it. Edges count from their top row up to but not including their bottom
+// one, which is the same rule as vga_fillpoly's spans.
+static void ref_fillpoly(const int *xy, int n)
+{
+	for (int y = 0; y < (int)vga_height; y++)
+		for (int x = 0; x < (int)vga_width; x++)
+		{
+			int crossings = 0;
+
+			for (int i = 0; i < n; i++)
+			{
+				int j = (i + 1) % n;
+				int xa = xy[i * 2], ya = xy[i * 2 + 1];
+				int xb = xy[j * 2], yb = xy[j * 2 + 1];
+
+				if (ya > yb)
+				{
+					int t = xa; xa = xb; xb = t;
+					t = ya; ya = yb; yb = t;
+				}
+				if (y >= ya && y < yb && (long long)(x - xa) * (yb - ya) >= (long long)(y - ya) * (xb - xa))
+					crossings++;
+			}
+
+			if (crossings & 1)
+				ref_plot(x, y);
+		}
+
+	for (int i = 0; i < n; i++)
+	{
+		int j = (i + 1) % n;
+		ref_line(xy[i * 2], xy[i * 2 + 1], xy[j * 2], xy[j * 2 + 1]);
+	}
+}
+
+static int test_floodfills(void)
+{
+	for (int n = 0; n < TEST_FILLS; n++)
+	{
+		// the clutter is drawn by vga.c alone, then copied to the reference
+		for (int i = 0; i < TEST_CLUTTER; i++)
+		{
+			next_shape(i == 0 ? 0 : 1 + (i % 3));
+			if (i & 1)
+				vga_drawcircle(test_random(0, TEST_WIDTH), test_random(0, TEST_HEIGHT), test_random(2, TEST_HEIGHT / 2));
+			else
+				vga_drawline(test_random(-8, TEST_WIDTH + 8), test_random(-8, TEST_HEIGHT + 8),
+					test_random(-8, TEST_WIDTH + 8), test_random(-8, TEST_HEIGHT + 8));
+		}
+		memcpy(expect, vga_framebuffer, vga_height * vga_pitch);
+
+		int x = test_random(0, TEST_WIDTH - 1);
+		int y = test_random(0, TEST_HEIGHT - 1);
+
+		next_shape(1 + (n % 4));
+		if (!vga_floodfill(x, y))
+		{
+			printf("floodfill,%u: fill %d ran out of stack\n", vga_bpp, n);
+			return 0;
+		}
+		ref_floodfill(x, y);
+		if (!compare("floodfill", n))
+			return 0;
+	}
+	return 1;
+}
+
+static int test_polys(void)
+{
+	int xy[TEST_MAXSIDES * 2];
+
+	for (int n = 0; n < TEST_POLYS; n++)
+	{
+		int sides = test_random(3, TEST_MAXSIDES);
+
+		for (int i = 0; i < sides; i++)
+		{
+			xy[i * 2] = test_random(-TEST_WIDTH / 2, TEST_WIDTH * 3 / 2);
+			xy[i * 2 + 1] = test_random(-TEST_HEIGHT / 2, TEST_HEIGHT * 3 / 2);
+		}
+
+		next_shape(n);
+		vga_fillpoly(xy, sides);
+		ref_fillpoly(xy, sides);
+		if (!compare("fillpoly", n))
+			return 0;
+	}
+	return 1;
+}
+
+static int test_cliprect(void)
+{
+	static const int cases[][8] =
+	{
+		// in x1,y1,x2,y2, then out x1,y1,x2,y2 or all -1 when nothing is left
+		{ 10, 20, 30, 40,  10, 20, 30, 40 },
+		{ -5, -5, 5, 5,  0, 0, 5, 5 },
+		{ 300, 190, 400, 300,  300, 190, TEST_WIDTH, TEST_HEIGHT },
+		{ -100, 50, 1000, 60,  0, 50, TEST_WIDTH, 60 },
+		{ -10, 0, 0, 10,  -1, -1, -1, -1 },
+		{ TEST_WIDTH, 0, TEST_WIDTH + 5, 10,  -1, -1, -1, -1 },
+		{ 20, 20, 20, 30,  -1, -1, -1, -1 },
+		{ 30, 20, 20, 30,  -1, -1, -1, -1 },
+	};
+
+	for (u32 i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		const int *c = cases[i];
+		int x1 = c[0], y1 = c[1], x2 = c[2], y2 = c[3];
+		int left = vga_cliprect(&x1, &y1, &x2, &y2);
+
+		if (left != (c[4] != -1) || (left && (x1 != c[4] || y1 != c[5] || x2 != c[6] || y2 != c[7])))
+		{
+			printf("cliprect: case %u gave %d %d,%d,%d,%d\n", i, left, x1, y1, x2, y2);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+typedef int (*test_fn)(void);
+
+int main(int argc, char **argv)
+{
+	static const u32 depths[] = { 8, 16, 24, 32 };
+	static const struct { const char *name; test_fn fn; } tests[] =
+	{
+		{ "cliprect", test_cliprect },
+		{ "line", test_lines },
+		{ "rect", test_rects },
+		{ "circle", test_circles },
+		{ "floodfill", test_floodfills },
+		{ "fillpoly", test_polys },
+	};
+
+	vga_init(TEST_WIDTH, TEST_HEIGHT, depths[0]);
+
+	for (u32 d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+	{
+		if (!vga_setmode(TEST_WIDTH, TEST_HEIGHT, depths[d]))
+		{
+			fprintf(stderr, "no %ubpp mode\n", depths[d]);
+			return 1;
+		}
+
+		free(expect);
+		expect = (u8*)malloc(vga_height * vga_pitch);
+
+		for (u32 t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+		{
+			test_seed = 1;
+			if (!tests[t].fn())
+				return 1;
+			printf("%s,%u,ok\n", tests[t].name, vga_bpp);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+// Host benchmark and check of src/numfmt.c. Times fmt_shorttoa against the
+// snprintf formats PRINT used before, then checks that fmt_shorttoa reads
+// back as the same value with strtod/strtof and uses no more digits than
+// the shortest %.<n>e that does. Prints CSV rows test,value,unit and exits
+// with 1 if any value fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "numfmt.h"
+
+#define NUM_VALUES		200000		// random values timed in turn
+#define NUM_USEC		250000		// time spent on each test
+#define NUM_CHECKS		200000		// values put through the round-trip check
+
+static double values[NUM_VALUES];
+static float singles[NUM_VALUES];
+static char buf[FMT_MAXLEN + 1];
+
+static uint64_t num_seed = 88172645463325252ull;
+
+static uint64_t num_random(void)
+{
+	num_seed ^= num_seed << 13;
+	num_seed ^= num_seed >> 7;
+	num_seed ^= num_seed << 17;
+	return num_seed;
+}
+
+static uint32_t num_clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((ts.tv_sec * 1000000ull) + (ts.tv_nsec / 1000));
+}
+
+// Any finite double or float bit pattern, so every exponent is covered
+static double num_double(void)
+{
+	union { double d; uint64_t u; } b;
+	do
+		b.u = num_random();
+	while (b.d != b.d || b.d - b.d != 0);
+	return b.d;
+}
+
+static float num_single(void)
+{
+	union { float f; uint32_t u; } b;
+	do
+		b.u = (uint32_t)num_random();
+	while (b.f != b.f || b.f - b.f != 0);
+	return b.f;
+}
+
+// Each test formats value n and returns the length, which is summed so the
+// calls cannot be dropped
+typedef int (*num_fn)(uint32_t n);
+
+static int test_printf_g(uint32_t n)
+{
+	return snprintf(buf, sizeof(buf), "%g", singles[n]);
+}
+
+static int test_printf_9g(uint32_t n)
+{
+	return snprintf(buf, sizeof(buf), "%.9g", singles[n]);
+}
+
+static int test_printf_17g(uint32_t n)
+{
+	return snprintf(buf, sizeof(buf), "%.17g", values[n]);
+}
+
+static int test_short_single(uint32_t n)
+{
+	return fmt_shorttoa(buf, singles[n], FMT_SINGLE | FMT_CBM);
+}
+
+static int test_short_double(uint32_t n)
+{
+	return fmt_shorttoa(buf, values[n], 0);
+}
+
+static unsigned num_sum;
+
+static void bench(const char *name, num_fn fn)
+{
+	uint32_t calls = 0;
+	uint32_t start = num_clock_us();
+	uint32_t elapsed;
+
+	do
+	{
+		for (uint32_t i = 0; i < 64; i++)
+			num_sum += fn(calls++ % NUM_VALUES);
+		elapsed = num_clock_us() - start;
+	}
+	while (elapsed < NUM_USEC);
+
+	printf("%s,%.0f,ns/call\n", name, elapsed * 1000.0 / calls);
+}
+
+// Fewest significant digits %.<n>e needs to read back as value
+static int num_shortest_printf(double value, int single)
+{
+	char ref[40];
+	int n;
+
+	for (n = 1; n < FMT_MAXDIGITS; n++)
+	{
+		snprintf(ref, sizeof(ref), "%.*e", n - 1, value);
+		if (single ? strtof(ref, 0) == (float)value : strtod(ref, 0) == value)
+			break;
+	}
+	return n;
+}
+
+// Returns the number of values that failed
+static int check(const char *name, int single)
+{
+	char digits[FMT_MAXDIGITS + 1];
+	int failed = 0;
+
+	for (uint32_t i = 0; i < NUM_CHECKS; i++)
+	{
+		double v = single ? num_single() : num_double();
+
+		fmt_shorttoa(buf, v, single ? FMT_SINGLE : 0);
+		fmt_shortest(v, single, digits);
+
+		if ((single ? strtof(buf, 0) != (float)v : strtod(buf, 0) != v)
+			|| (int)strlen(digits) > num_shortest_printf(v, single))
+		{
+			if (failed++ < 5)
+				fprintf(stderr, "%s: %a gave %s\n", name, v, buf);
+		}
+	}
+
+	printf("%s,%d,failures\n", name, failed);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	for (uint32_t i = 0; i < NUM_VALUES; i++)
+	{
+		values[i] = num_double();
+		singles[i] = num_single();
+	}
+
+	printf("test,value,unit\n");
+	bench("printf_g", test_printf_g);
+	bench("printf_9g", test_printf_9g);
+	bench("printf_17g", test_printf_17g);
+	bench("shorttoa_single", test_short_single);
+	bench("shorttoa_double", test_short_double);
+
+	int failed = check("roundtrip_single", 1);
+	failed += check("roundtrip_double", 0);
+
+	return failed != 0 || num_sum == 0;
+}
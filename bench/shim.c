@@ -0,0 +1,184 @@
+// Host replacements for the firmware mailbox, kernel timers and cache
+// maintenance, enough for vga.c and terminal.cpp to run unchanged, and the
+// vga globals main.cpp would define. The system timer page is mapped at its
+// real address so read32() works too.
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "rpi-hardware.h"
+#include "rpi-mailbox-interface.h"
+#include "timer.h"
+#include "cache.h"
+#include "vga.h"
+
+#define BENCH_MAXTAGS	16
+
+static u32 mb_width = 640, mb_height = 400, mb_vheight = 400, mb_depth = 16;
+static u8 *mb_buffer;
+static u32 mb_buffersize;
+static int mb_tags[BENCH_MAXTAGS];
+static int mb_tagcount;
+
+static volatile u32 *mb_systimer;
+
+float vga_scaleX;
+float vga_scaleY;
+u32 vga_width;
+u32 vga_height;
+u32 vga_bpp;
+u32 vga_pitch;
+u8* vga_framebuffer;
+u8* vga_pages[2];
+u32 vga_pagecount;
+u32 vga_visiblepage;
+funcptr vga_plotpixelFn;
+u32 vga_font_width = 8;
+u32 vga_font_height = 8;
+u32 vga_font_scale = 1;
+u32 vga_font_glyphs = 128;
+const uint8_t* vga_current_font = font8x8_basic;
+
+__attribute__((constructor)) static void bench_mapsystimer(void)
+{
+	void *p = mmap((void *)ARM_SYSTIMER_BASE, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != MAP_FAILED)
+		mb_systimer = (volatile u32 *)p;
+}
+
+// the host clock in microseconds; the mapped timer follows it
+u32 bench_clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	u32 now = (u32)((ts.tv_sec * 1000000ull) + (ts.tv_nsec / 1000));
+	if (mb_systimer)
+		mb_systimer[(ARM_SYSTIMER_CLO - ARM_SYSTIMER_BASE) >> 2] = now;
+	return now;
+}
+
+// vga.c masks the address it gets back like a bus address, so the buffer
+// has to sit below 1GB
+static u8 *mb_alloc(u32 size)
+{
+	void *p = mmap((void *)0x10000000, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	return p == MAP_FAILED ? 0 : (u8 *)p;
+}
+
+void RPI_PropertyInit(void)
+{
+	mb_tagcount = 0;
+}
+
+void RPI_PropertyAddTag(rpi_mailbox_tag_t tag, ...)
+{
+	va_list vl;
+	va_start(vl, tag);
+
+	switch (tag)
+	{
+		case TAG_SET_PHYSICAL_SIZE:
+			mb_width = va_arg(vl, int);
+			mb_height = va_arg(vl, int);
+			break;
+		case TAG_SET_VIRTUAL_SIZE:
+			va_arg(vl, int);
+			mb_vheight = va_arg(vl, int);
+			break;
+		case TAG_SET_DEPTH:
+			mb_depth = va_arg(vl, int);
+			break;
+		case TAG_RELEASE_BUFFER:
+			if (mb_buffer)
+				munmap(mb_buffer, mb_buffersize);
+			mb_buffer = 0;
+			break;
+		default:
+			break;
+	}
+
+	if (mb_tagcount < BENCH_MAXTAGS)
+		mb_tags[mb_tagcount++] = tag;
+
+	va_end(vl);
+}
+
+int RPI_PropertyProcess(void)
+{
+	for (int i = 0; i < mb_tagcount; i++)
+		if (mb_tags[i] == TAG_ALLOCATE_BUFFER && !mb_buffer)
+		{
+			mb_buffersize = mb_width * mb_vheight * (mb_depth >> 3);
+			mb_buffer = mb_alloc(mb_buffersize);
+		}
+	return 0;
+}
+
+void RPI_PropertyProcessNoCheck(void)
+{
+	RPI_PropertyProcess();
+}
+
+// Only the answers vga.c reads back are given; anything else looks like a
+// tag the firmware does not know, which keeps the software cursor.
+rpi_mailbox_property_t *RPI_PropertyGet(rpi_mailbox_tag_t tag)
+{
+	static rpi_mailbox_property_t property;
+	int found = 0;
+
+	for (int i = 0; i < mb_tagcount; i++)
+		if (mb_tags[i] == (int)tag)
+			found = 1;
+	if (!found)
+		return 0;
+
+	property.tag = tag;
+	property.byte_length = 8;
+	switch (tag)
+	{
+		case TAG_ALLOCATE_BUFFER:
+			property.data.buffer_32[0] = (int)(uintptr_t)mb_buffer;
+			property.data.buffer_32[1] = mb_buffersize;
+			break;
+		case TAG_GET_PHYSICAL_SIZE:
+			property.data.buffer_32[0] = mb_width;
+			property.data.buffer_32[1] = mb_height;
+			break;
+		case TAG_GET_VIRTUAL_SIZE:
+			property.data.buffer_32[0] = mb_width;
+			property.data.buffer_32[1] = mb_vheight;
+			break;
+		case TAG_GET_DEPTH:
+			property.data.buffer_32[0] = mb_depth;
+			break;
+		case TAG_GET_PITCH:
+			property.data.buffer_32[0] = mb_width * (mb_depth >> 3);
+			break;
+		default:
+			return 0;
+	}
+
+	return &property;
+}
+
+unsigned TimerStartKernelTimer(unsigned nDelay, TKernelTimerHandler *pHandler, void *pParam, void *pContext)
+{
+	return 0;
+}
+
+void set_section_attr(unsigned base, unsigned size, int attr)
+{
+}
+
+void clean_dcache_range(void *start, unsigned length)
+{
+}
+
+void clean_invalidate_dcache_range(void *start, unsigned length)
+{
+}
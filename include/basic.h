@@ -1,6 +1,8 @@
 #ifndef BASIC_H
 #define BASIC_H
 
+#include "ff.h"
+
 extern "C"
 {
 
@@ -12,11 +14,38 @@ extern "C"
 
 #define VAR_NAMESZ 2       /* maximum variable name length */
 #define CMD_NAMESZ 10       /* limit for command words */
-#define CMD_COUNT 25        /* number of available commands */
+#define CMD_COUNT 45        /* number of available commands */
 #define DATA_STSZ 16        /* depth of calculation */
 #define CALL_STSZ 16        /* subroutine call depth */
+#define ARRAY_MAX 32        /* arrays a program can have */
+#define ARRAY_DEFAULT 10    /* highest index of an array used without DIM */
 #define LINE_SZ 80          /* line width restriction */
 #define CODE_SZ 4096        /* program size in characters */
+#define LOAD_CHUNK 16384    /* bytes LOAD reads from the file at a time */
+#define LOAD_LINEMAX 159    /* longest line LOAD keeps */
+#define SAVE_CHUNK 16384    /* bytes SAVE writes to the file at a time */
+#define SAVE_TEMPNAME "SAVE$$$.TMP"	/* written first, then renamed */
+#define FILENAME_SZ 15      /* longest name LOAD and SAVE take */
+
+/* A .PRG file: this header, then a prgline per program line in order, then
+   the text of every line with its terminating zero. The checksum covers
+   everything after the header. */
+#define PRG_MAGIC 0x31504250	/* "PBP1" */
+
+struct prgheader
+{
+	unsigned int magic;
+	unsigned int lines;
+	unsigned int textsize;
+	unsigned int checksum;
+};
+
+struct prgline
+{
+	int linenum;
+	unsigned int offset;	/* into the text */
+};
+
 #define FILE_SUPPORT 0   	/* 0 - no, 1 - yes */
 
 #define ERR_NONE			0
@@ -29,6 +58,17 @@ extern "C"
 #define ERR_TYPE_MISMATCH	-7
 #define ERR_NEXT_WO_FOR		-8
 #define ERR_ILLEGAL_DIRECT	-9
+#define ERR_OUT_OF_MEMORY	-10
+#define ERR_ILLEGAL_QUANTITY	-11
+#define ERR_FILE_OPEN		-12
+#define ERR_FILE_NOT_OPEN	-13
+#define ERR_FILE_NOT_FOUND	-14
+#define ERR_NOT_INPUT		-15
+#define ERR_NOT_OUTPUT		-16
+#define ERR_FILE_DATA		-17
+#define ERR_DISK			-18
+#define ERR_BAD_SUBSCRIPT	-19
+#define ERR_REDIM			-20
 
 #define VAR_NONE	0
 #define VAR_INT		1
@@ -89,6 +129,15 @@ struct Variable
 	void* location;
 };
 
+/* A numeric array: float elements, or int ones when the name ends in % */
+struct Array
+{
+	unsigned char name[VAR_NAMESZ + 2];
+	int size;			/* elements, the highest index + 1 */
+	void *location;		/* the elements, unless they are in a file */
+	int file;			/* farray handle for DIM ... FILE, otherwise -1 */
+};
+
 struct Command
 {
 	unsigned char name[CMD_NAMESZ];
@@ -102,7 +151,9 @@ struct Context
 	struct Variable vars[100];
 	struct Command cmds[CMD_COUNT];
 	int var_count;
-	float dstack[DATA_STSZ];
+	struct Array arrays[ARRAY_MAX];
+	int array_count;
+	double dstack[DATA_STSZ];
 	int cstack[CALL_STSZ];
 	int dsptr;
 	int csptr;
@@ -125,6 +176,8 @@ void exec_program(struct Context* ctx);
 void exec_line(struct Context *ctx);
 int exec_expr(struct Context *ctx);
 int exec_strexpr(struct Context *ctx, int* len);
+int exec_fn_str(struct Context *ctx, int lpos, unsigned char *out);
+bool is_fn_str(const unsigned char *s, int i);
 void handle_error(struct Context *ctx);
 	
 void exec_cmd_dim(struct Context *ctx);
@@ -138,6 +191,14 @@ void exec_cmd_input(struct Context *ctx);
 void exec_cmd_let(struct Context*);
 void exec_cmd_list(struct Context *ctx);
 void exec_cmd_load(struct Context *ctx);
+void load_line(const char *text, int len);
+bool get_filename(struct Context *ctx, char *fnbuffer);
+bool is_prg(const char *fnbuffer);
+unsigned int prg_checksum(const unsigned char *data, unsigned int len);
+FRESULT load_text(FIL *fp);
+FRESULT load_prg(FIL *fp);
+FRESULT save_text(FIL *fp);
+FRESULT save_prg(FIL *fp);
 void exec_cmd_new(struct Context *ctx);
 void exec_cmd_next(struct Context *ctx);
 void exec_cmd_print(struct Context *ctx);
@@ -146,11 +207,46 @@ void exec_cmd_return(struct Context *ctx);
 void exec_cmd_run(struct Context *ctx);
 void exec_cmd_save(struct Context *ctx);
 void exec_cmd_then(struct Context *ctx);
+void exec_cmd_plot(struct Context *ctx);
+void exec_cmd_line(struct Context *ctx);
+void exec_cmd_box(struct Context *ctx);
+void exec_cmd_circle(struct Context *ctx);
+void exec_cmd_color(struct Context *ctx);
+void exec_cmd_paint(struct Context *ctx);
+void exec_cmd_poly(struct Context *ctx);
+void exec_cmd_screen(struct Context *ctx);
+void exec_cmd_flip(struct Context *ctx);
+void exec_cmd_sprite(struct Context *ctx);
+void exec_cmd_font(struct Context *ctx);
+void exec_cmd_palette(struct Context *ctx);
+void exec_cmd_open(struct Context *ctx);
+void exec_cmd_close(struct Context *ctx);
+void exec_cmd_get(struct Context *ctx);
+void exec_cmd_print_dev(struct Context *ctx);
+void exec_cmd_input_dev(struct Context *ctx);
+void exec_cmd_record(struct Context *ctx);
+void exec_cmd_bload(struct Context *ctx);
+void exec_cmd_bsave(struct Context *ctx);
+bool get_block(struct Context *ctx, FSIZE_t loadsize, BYTE **data, UINT *size);
+bool get_quoted(struct Context *ctx, char *buffer, int size);
+int get_channel(struct Context *ctx);
+bool check_channel(struct Context *ctx, int n);
+void file_error(struct Context *ctx, FRESULT res);
+FRESULT input_field(int ch, unsigned char *field, int size, bool *end);
+bool print_items(struct Context *ctx, int ch);
+void print_out(struct Context *ctx, int ch, const char *text, int len);
+int exec_exprlist(struct Context *ctx, int *values, int min, int max);
 
 void var_clear_all(struct Context *ctx);
 void var_add_update_int(struct Context *ctx, const unsigned char *key, int value);
 void var_add_update_float(struct Context *ctx, const unsigned char *key, float value);
 void var_add_update_string(struct Context *ctx, const unsigned char *key, unsigned char* value, int length);
+struct Array *array_find(struct Context *ctx, const unsigned char *name);
+struct Array *array_dim(struct Context *ctx, const unsigned char *name, int size, const char *file);
+bool array_get(struct Context *ctx, const unsigned char *name, int index, double *value);
+bool array_set(struct Context *ctx, const unsigned char *name, int index, double value);
+void array_clear_all(struct Context *ctx);
+int exec_subscript(struct Context *ctx, int lpos, int *index);
 	
 bool compare(const unsigned char *a, const unsigned char *b);
 void clear(unsigned char *dst, int size);
@@ -261,5 +357,22 @@ void tokenize(struct Context* ctx, const unsigned char* input, unsigned char *ou
 #define TOKEN_MID$			202	
 #define TOKEN_GO			203	
 #define TOKEN_DIR			204
+
+// PiBASIC extensions
+#define TOKEN_PLOT			205
+#define TOKEN_LINE			206
+#define TOKEN_BOX			207
+#define TOKEN_CIRCLE		208
+#define TOKEN_COLOR			209
+#define TOKEN_PAINT			210
+#define TOKEN_POLY			211
+#define TOKEN_SCREEN		212
+#define TOKEN_FLIP			213
+#define TOKEN_SPRITE		214
+#define TOKEN_FONT			215
+#define TOKEN_PALETTE		216
+#define TOKEN_RECORD		217
+#define TOKEN_BLOAD			218
+#define TOKEN_BSAVE			219
 }
 #endif
\ No newline at end of file
@@ -21,12 +21,24 @@
 // can play tricks with banks selection
 #define NUM_4K_PAGES 512
 
+// Memory types for set_section_attr
+#define MEM_ATTR_DEVICE        0   // every store goes out on its own
+#define MEM_ATTR_WRITECOMBINE  1   // not cached, stores merge in the write buffer
+#define MEM_ATTR_WRITETHROUGH  2
+#define MEM_ATTR_WRITEBACK     3   // needs clean_dcache_range before another master reads it
+
 #ifndef __ASSEMBLER__
 
 void map_4k_page(int logical, int physical);
 
 void enable_MMU_and_IDCaches(void);
 
+void set_section_attr(unsigned base, unsigned size, int attr);
+
+void clean_dcache_range(void *start, unsigned length);
+
+void clean_invalidate_dcache_range(void *start, unsigned length);
+
 #endif
 
 #endif
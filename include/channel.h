@@ -0,0 +1,58 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Numbered files for OPEN, CLOSE, PRINT#, INPUT#, GET# and RECORD#. Each
+// channel reads and writes through its own buffer of whole sectors, so
+// FatFs moves full sectors straight to and from the card. Record channels
+// also keep a FatFs cluster link map, so going to a record does not walk the
+// FAT chain from the start of the file.
+
+#define CHAN_MAX		15		// channels 1 to 15
+#define CHAN_SECTOR		512		// FatFs sector size (_MAX_SS)
+#define CHAN_SEQSECTORS	32		// buffer of a sequential channel
+#define CHAN_RECMAX		4096	// longest record
+#define CHAN_LINKMAP	32		// link map entries to start with; grown for fragmented files
+
+#define CHAN_READ		0		// sequential, from the start of an existing file
+#define CHAN_WRITE		1		// sequential, replacing the file
+#define CHAN_APPEND		2		// sequential, after the end of the file
+#define CHAN_RECORD		3		// fixed length records, read and written anywhere
+
+FRESULT chan_open(int n, const char *name, int mode, UINT reclen);
+FRESULT chan_close(int n);
+void chan_closeall();
+
+// write everything buffered by every channel out to the card
+FRESULT chan_sync();
+
+int chan_isopen(int n);
+int chan_mode(int n);
+
+// *c is the next byte, or -1 at the end of the file. On a record channel
+// the zeros that fill out a record and the end of the record also give -1.
+FRESULT chan_getc(int n, int *c);
+
+// chan_getc would give -1
+int chan_eof(int n);
+
+// on a record channel anything past the end of the record is dropped
+FRESULT chan_write(int n, const void *data, UINT len);
+
+// go to byte (1 based) of record rec (1 based); a record past the end of the
+// file is created, filled with zeros, when it is first written
+FRESULT chan_record(int n, DWORD rec, UINT byte);
+
+// fill the rest of the current record with zeros and move on to the next
+FRESULT chan_endrecord(int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
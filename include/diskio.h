@@ -26,11 +26,28 @@ typedef enum {
 } DRESULT;
 
 
+/* Sector cache between FatFs and the card */
+#define DISK_CACHE_SECTORS	128		/* sectors kept */
+#define DISK_READAHEAD		8		/* extra sectors fetched by sequential reads */
+#define DISK_STAGE_SECTORS	32		/* larger transfers bypass the cache */
+
+typedef struct {
+	DWORD	hits;			/* sectors found in the cache */
+	DWORD	misses;			/* sectors read from the card for FatFs */
+	DWORD	readahead;		/* sectors read ahead of a request */
+	DWORD	writebacks;		/* dirty sectors written to the card */
+} DISK_CACHESTATS;
+
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
 
 void disk_setEMM(CEMMCDevice* pEMMCDevice);
+void disk_setimage(BYTE *image, DWORD sectors);
+void disk_getlatency(unsigned command, u32 *buckets);	/* EMMC_LATENCY_BUCKETS counts */
+void disk_getcachestats(DISK_CACHESTATS *stats);
+void disk_resetstats(void);
 
 DSTATUS disk_initialize (BYTE pdrv);
 DSTATUS disk_status (BYTE pdrv);
@@ -17,6 +17,8 @@
 
 #define BOOT_SIGNATURE		0xAA55
 
+#define EMMC_LATENCY_BUCKETS	16	// powers of two of microseconds, the last open ended
+
 struct TSCR			// SD configuration register
 {
 	u32	scr[2];
@@ -41,6 +43,15 @@ public:
 	int DoRead(u8 *buf, size_t buf_size, u32 block_no);
 	int DoWrite(u8 *buf, size_t buf_size, u32 block_no);
 
+	// from the CSD, in 512 byte sectors
+	u32 GetSectorCount(void);
+	u32 GetEraseBlockSize(void);
+	int DoErase(u32 first, u32 last);
+
+	// how long each command index took from issue to completion
+	void GetLatency(unsigned command, u32 *buckets);
+	void ResetLatency(void);
+
 private:
 	bool PowerOn(void);
 	void PowerOff(void);
@@ -64,6 +75,9 @@ private:
 	int DoDataCommand(int is_write, u8 *buf, size_t buf_size, u32 block_no);
 
 	int TimeoutWait(unsigned reg, unsigned mask, int value, unsigned usec);
+	void RecordLatency(u32 cmd_reg, u32 usec);
+	u32 CSDField(unsigned start, unsigned width);
+	void ParseCSD(void);
 
 	void usDelay(unsigned usec);
 
@@ -74,6 +88,10 @@ private:
 
 	// was: struct emmc_block_dev
 	u32 m_device_id[4];
+	u32 m_csd[4];
+	u32 m_sector_count;
+	u32 m_erase_sectors;
+	u32 m_erase_single;
 
 	u32 m_card_supports_sdhc;
 	u32 m_card_supports_18v;
@@ -100,6 +118,8 @@ private:
 	int m_card_removal;
 	u32 m_base_clock;
 
+	u32 m_latency[64][EMMC_LATENCY_BUCKETS];
+
 	static const char *sd_versions[];
 	static const char *err_irpts[];
 	static const u32 sd_commands[];
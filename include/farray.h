@@ -0,0 +1,39 @@
+#ifndef FARRAY_H
+#define FARRAY_H
+
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Arrays kept in files, for DIM ... FILE. Elements are read and written
+// through a cache of fixed size pages shared by every file array, so memory
+// use stays the same however large the files are. The least recently used
+// page is evicted first, dirty pages are written back when evicted or on
+// farray_sync, and a miss on the page after the last one read also reads the
+// next FARRAY_READAHEAD pages in the same transfer.
+
+#define FARRAY_MAX			8		// file arrays open at once
+#define FARRAY_PAGE			4096	// bytes per page, a whole number of sectors
+#define FARRAY_PAGES		64		// pages in the cache
+#define FARRAY_READAHEAD	7		// extra pages read once access is sequential
+
+// Open or create the file behind an array of count elements of elemsize
+// bytes. Elements past the end of an existing file read as zero until they
+// are written. *h is the handle for the other calls.
+FRESULT farray_open(const char *name, DWORD count, UINT elemsize, int *h);
+FRESULT farray_close(int h);
+void farray_closeall();
+
+FRESULT farray_get(int h, DWORD index, void *value);
+FRESULT farray_put(int h, DWORD index, const void *value);
+
+// write every dirty page out to the card
+FRESULT farray_sync();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,7 +30,15 @@ u32 vga_height;
 u32 vga_bpp;
 u32 vga_pitch;
 u8* vga_framebuffer;
+u8* vga_pages[2];
+u32 vga_pagecount;
+u32 vga_visiblepage;
 funcptr vga_plotpixelFn;
+u32 vga_font_width = 8;
+u32 vga_font_height = 8;
+u32 vga_font_scale = 1;
+u32 vga_font_glyphs = 128;
+const uint8_t* vga_current_font = font8x8_basic;
 
 extern "C"
 {
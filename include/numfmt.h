@@ -0,0 +1,46 @@
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number to text conversion that does not go through libc snprintf.
+// All functions write into the caller's buffer, NUL terminate it and
+// return the number of characters written (excluding the NUL).
+
+#define FMT_MAXDIGITS	17		// significant digits a double can carry
+#define FMT_MAXPREC		40		// precision is clamped to this
+#define FMT_SINGLEDIGITS	9		// enough to round trip any float
+#define FMT_MAXLEN		(1 + 309 + 1 + FMT_MAXPREC + 1)	// worst case %f of a double
+#define FMT_SHORTLEN	64		// fmt_shorttoa, except FMT_PLAIN of a double (FMT_MAXLEN)
+
+// fmt_shorttoa flags
+#define FMT_SINGLE		1		// the value is a float; round trip at float precision
+#define FMT_PLAIN		2		// never use an exponent (for text fed back to the parser)
+#define FMT_CBM			4		// Commodore PRINT layout: " 5", "-.25", " 1.5E+10"
+
+int fmt_utoa(char *buf, uint32_t value, unsigned base, int upper);
+int fmt_itoa(char *buf, int32_t value);
+int fmt_u64toa(char *buf, uint64_t value);
+
+// ndigits (1..FMT_MAXDIGITS) significant digits of |value|, rounded.
+// Returns the decimal exponent of the first digit.
+int fmt_dtod(double value, int ndigits, char *digits);
+
+int fmt_ftoa(char *buf, double value, int prec);				// %.<prec>f
+int fmt_etoa(char *buf, double value, int prec, int upper);		// %.<prec>e
+int fmt_gtoa(char *buf, double value, int prec, int alt);		// %.<prec>g
+
+// Fewest significant digits that read back as the same value, trailing zeros
+// removed. Returns the decimal exponent of the first digit.
+int fmt_shortest(double value, int single, char *digits);
+int fmt_shorttoa(char *buf, double value, int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
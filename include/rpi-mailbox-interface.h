@@ -133,8 +133,8 @@ typedef enum {
 	TAG_GET_GPIOVIRTBUF = 0x40010,
 
 
-    TAG_SET_CURSOR_INFO = 0x8011,
-    TAG_SET_CURSOR_STATE = 0x8010,
+    TAG_SET_CURSOR_INFO = 0x8010,
+    TAG_SET_CURSOR_STATE = 0x8011,
 
 	TAG_USB = 0xB880
 
@@ -0,0 +1,38 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Software sprites composited onto the draw page. Bitmaps are kept in the
+// framebuffer's pixel format with the opaque pixels of each row stored as
+// runs, and the background under each sprite is saved per page so moving a
+// sprite only touches the rectangles that changed.
+
+#define SPRITE_MAX		32
+#define SPRITE_MAXSIZE	256		// width and height limit
+
+// Capture w x h pixels at x,y of the draw page as sprite n. Pixels in the
+// current background colour are transparent. Returns 0 on a bad argument or
+// when out of memory.
+int sprite_define(int n, int x, int y, int w, int h);
+int sprite_move(int n, int x, int y);
+int sprite_off(int n);
+
+// turn every sprite off and forget it, restoring what was under them
+void sprite_reset();
+
+// redraw whatever changed since the last update on the current draw page
+void sprite_update();
+
+// the draw page has just been copied from page 'from'
+void sprite_clonepage(int from, int to);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,22 +8,42 @@ extern "C"
 #include "rpi-gpio.h"
 #include "rpi-hardware.h"
 #include "timer.h"
+#include <stdarg.h>
 
 	
 typedef unsigned char       BYTE;
-typedef unsigned int   		size_t;
 
+// the text grid is kept as two planes: the glyph of each cell and its
+// attribute, an index into the terminal's colour pairs
 static uint8_t* vga_screenmem;
+static uint8_t* term_attrmem;
 static uint8_t  term_row;
 static uint8_t	term_col;
 static uint8_t  term_cursor_mode;
 static uint8_t  term_cursor_on;
+static uint8_t* term_dirtyrows;
+static uint32_t term_scroll_pending;
+static uint32_t term_stage_start;
+static volatile uint8_t term_blink_pending;
+static uint8_t  term_hwcursor;		// the display draws the cursor
+static uint8_t  term_hwrow;
+static uint8_t  term_hwcol;
+static uint32_t term_hwcolour;
+
+#define TERM_ATTR_INVERSE	0x80	// cell drawn with its colours swapped
+#define TERM_MAXPAIRS		128		// colour pairs an attribute can refer to
 
 void term_init(Keyboard *keyboard);
+void term_layout();
 void term_putchar(uint8_t c);
 void term_puts(char* text);
+void term_putn(const char* text, uint32_t len);
+void term_write(const char* text, uint32_t len);
+uint32_t term_rows();
+uint32_t term_cols();
 
-void term_printf(char* text, ...);
+void term_printf(const char* text, ...);
+void term_vprintf(const char* text, va_list ap);
 void term_getcharat(uint8_t col, uint8_t row, uint8_t* ch);
 void term_putcharat(uint8_t col, uint8_t row, uint8_t ch);
 void term_rc2xy(uint8_t col, uint8_t row, uint32_t* x, uint32_t* y);
@@ -31,6 +51,8 @@ void term_showcursor();
 void term_hidecursor();
 void term_toggle_cursor();
 void term_scroll();
+void term_flush();
+void term_update();
 uint8_t term_getchar();
 void term_cursorblink_handler(unsigned hTimer, void *pParam, void *pContext);
 
@@ -8,6 +8,7 @@
 //#include "stb_image_config.h"
 #include "rpi-mailbox-interface.h"
 #include "font_data.h"
+#include "cache.h"
 
 typedef u32 RGBA;
 
@@ -28,15 +29,30 @@ typedef u32 RGBA;
 #define COLOUR_PURPLE 	RGBA(0xff, 0x00, 0x00, 0xff)
 #define COLOUR_GRAY 	RGBA(0x80, 0x80, 0x80, 0xff)
 
+// palette entry n rather than a true colour; real colours have a non-zero alpha
+#define VGA_INDEXED(n)	RGBA((n), 0, 0, 0)
+
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
-static const int vga_font_height = 8;
-static const int vga_font_width = 8;
-static const uint8_t* vga_current_font = font8x8_basic;
+#define VGA_FILLSTACK	2048	// pending runs a flood fill can hold
+#define VGA_MAXPOLY		64		// vertices in a filled polygon
+#define VGA_GLYPHS		256		// most characters in a font
+#define VGA_FONTS		2		// 0 is 8x8, 1 is the 8x16 VGA font
+#define VGA_FONTSCALE	3		// largest integer scale of a font
+#define VGA_GLYPHSETS	8		// colour pairs kept pre-rendered
+#define VGA_CURSORMAX	64		// largest hardware cursor
+#define VGA_MINWIDTH	320		// modes SCREEN w,h can ask for
+#define VGA_MINHEIGHT	200
+#define VGA_MAXWIDTH	1920
+#define VGA_MAXHEIGHT	1200
+#define VGA_BENCHPASSES	16		// full pages per vga_bandwidth measurement
+
 static u32 vga_current_fg_color = COLOUR_CYAN;
 static u32 vga_current_bg_color = COLOUR_BLUE;
 static u8 vga_cursor_mode = 1;
 
+extern const RGBA vga_colours[16];
+
 typedef void (*funcptr)(u32 pixel_offset);
 extern float vga_scaleX;
 extern float vga_scaleY;
@@ -44,8 +60,16 @@ extern u32 vga_width;
 extern u32 vga_height;
 extern u32 vga_bpp;
 extern u32 vga_pitch;
-extern u8* vga_framebuffer;
+extern u8* vga_framebuffer;		// the page being drawn to
+extern u8* vga_pages[2];			// page 1 is 0 if the firmware gave no room for it
+extern u32 vga_pagecount;
+extern u32 vga_visiblepage;
 extern funcptr vga_plotpixelFn;
+extern u32 vga_font_width;
+extern u32 vga_font_height;
+extern u32 vga_font_scale;
+extern u32 vga_font_glyphs;
+extern const uint8_t* vga_current_font;
 
 extern void RPI_PropertyInit( void );
 extern void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... );
@@ -55,15 +79,28 @@ extern rpi_mailbox_property_t* RPI_PropertyGet( rpi_mailbox_tag_t tag );
 
 void vga_init(u32 widthDesired, u32 heightDesired, u32 colourDepth);
 void vga_release();
+int vga_setmode(u32 width, u32 height, u32 depth);
+void vga_setcache(int attr);
+void vga_bandwidth(int attr, u32 *fill, u32 *scroll);
+int vga_setpages(u32 pages);
+void vga_flip(int vsync);
 void vga_clear();
 void vga_cleararea(u32 x1, u32 y1, u32 x2, u32 y2);
 
 void vga_setforecolor(RGBA color);
 void vga_setbackcolor(RGBA color);
+RGBA vga_getforecolor();
+RGBA vga_getbackcolor();
 void vga_swapcolors();
 
+void vga_setpalette(u32 first, u32 count, const RGBA *colours);
+RGBA vga_getpalette(u32 n);
+void vga_rotatepalette(u32 first, u32 last, int steps);
+
 void vga_cursor_on();
 void vga_cursor_off();
+int vga_hwcursor_define(u32 w, u32 h, RGBA color);
+void vga_hwcursor_move(int on, u32 x, u32 y);
 
 void vga_plotpixel32(u32 pixel_offset);
 void vga_plotpixel24(u32 pixel_offset);
@@ -71,18 +108,28 @@ void vga_plotpixel16(u32 pixel_offset);
 void vga_plotpixel8(u32 pixel_offset);
 void vga_plotpixel(u32 x, u32 y);
 
-void vga_drawline(u32 x1, u32 y1, u32 x2, u32 y2);
+u32 vga_pixelvalue(RGBA color);
+void vga_fillspan(int x1, int x2, int y, u32 pixel);
+
+void vga_drawline(int x1, int y1, int x2, int y2);
 void vga_drawlinev(u32 x, u32 y1, u32 y2);
-void vga_drawrect(u32 x0, u32 y0, u32 w, u32 h);
-void vga_drawcircle(u32 x0, u32 y0, u32 r);
+void vga_drawrect(int x0, int y0, int w, int h);
+void vga_fillrect(int x0, int y0, int w, int h);
+void vga_drawcircle(int x0, int y0, int r);
+void vga_fillcircle(int x0, int y0, int r);
+u32 vga_getpixel(int x, int y);
+int vga_floodfill(int x, int y);
+void vga_fillpoly(const int *xy, int n);
 //void vga_plotimage(u32* image, int x, int y, int w, int h);
 
-void vga_cliprect(u32 x1, u32 y1, u32 x2, u32 y2);
+int vga_cliprect(int *x1, int *y1, int *x2, int *y2);
+int vga_setfont(u32 font, u32 scale);
 void vga_drawchar(u32 x, u32 y, unsigned char c);
+void vga_drawglyph(u32 x, u32 y, unsigned char c, RGBA fg, RGBA bg);
 u32 vga_drawtext(u32 x, u32 y, char *ptr);
 void vga_drawcursor(u32 x, u32 y);
 void vga_erasecursor(u32 x, u32 y);
 
-void vga_scroll();
+void vga_scroll(u32 lines);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "terminal.h"
 #include "basic.h"
 #include "ff.h"
+#include "diskio.h"
 
 extern "C"
 {
@@ -10,6 +11,10 @@ extern "C"
 #include "vga.h"
 #include "linkedlist.h"
 #include "expr.h"
+#include "numfmt.h"
+#include "sprite.h"
+#include "channel.h"
+#include "farray.h"
 }
 
 #define _BUILD_NUM_ "0.1.0"
@@ -52,7 +57,7 @@ void basic_main()
 				// If the line doesnt exist, just add it.
 				// otherwise free the previous data memory and add the new line
 				if (nodeLine == NULL)
-					ll_insertFirst(linenum, data);
+					ll_insert(linenum, data);
 				else
 				{
 					free(nodeLine->data);
@@ -70,6 +75,8 @@ void basic_main()
 			ctx.linePos = 0;
 
 			exec_line(&ctx);
+			if (vga_pagecount == 1)
+				sprite_update();
 			ctx.error_line = -1;
 			handle_error(&ctx);
 
@@ -107,6 +114,26 @@ void exec_init(struct Context *ctx)
 	BINDCMD(&ctx->cmds[22], "LIST", true, exec_cmd_list, TOKEN_LIST);
 	BINDCMD(&ctx->cmds[23], "RUN", true, exec_cmd_run, TOKEN_RUN);
 	BINDCMD(&ctx->cmds[24], "DIR", true, exec_cmd_dir, TOKEN_DIR);
+	BINDCMD(&ctx->cmds[25], "PLOT", true, exec_cmd_plot, TOKEN_PLOT);
+	BINDCMD(&ctx->cmds[26], "LINE", true, exec_cmd_line, TOKEN_LINE);
+	BINDCMD(&ctx->cmds[27], "BOX", true, exec_cmd_box, TOKEN_BOX);
+	BINDCMD(&ctx->cmds[28], "CIRCLE", true, exec_cmd_circle, TOKEN_CIRCLE);
+	BINDCMD(&ctx->cmds[29], "COLOR", true, exec_cmd_color, TOKEN_COLOR);
+	BINDCMD(&ctx->cmds[30], "PAINT", true, exec_cmd_paint, TOKEN_PAINT);
+	BINDCMD(&ctx->cmds[31], "POLY", true, exec_cmd_poly, TOKEN_POLY);
+	BINDCMD(&ctx->cmds[32], "SCREEN", true, exec_cmd_screen, TOKEN_SCREEN);
+	BINDCMD(&ctx->cmds[33], "FLIP", true, exec_cmd_flip, TOKEN_FLIP);
+	BINDCMD(&ctx->cmds[34], "SPRITE", true, exec_cmd_sprite, TOKEN_SPRITE);
+	BINDCMD(&ctx->cmds[35], "FONT", true, exec_cmd_font, TOKEN_FONT);
+	BINDCMD(&ctx->cmds[36], "PALETTE", true, exec_cmd_palette, TOKEN_PALETTE);
+	BINDCMD(&ctx->cmds[37], "OPEN", true, exec_cmd_open, TOKEN_OPEN);
+	BINDCMD(&ctx->cmds[38], "CLOSE", true, exec_cmd_close, TOKEN_CLOSE);
+	BINDCMD(&ctx->cmds[39], "GET", true, exec_cmd_get, TOKEN_GET);
+	BINDCMD(&ctx->cmds[40], "PRINT#", true, exec_cmd_print_dev, TOKEN_PRINT_DEV);
+	BINDCMD(&ctx->cmds[41], "INPUT#", true, exec_cmd_input_dev, TOKEN_INPUT_DEV);
+	BINDCMD(&ctx->cmds[42], "RECORD", true, exec_cmd_record, TOKEN_RECORD);
+	BINDCMD(&ctx->cmds[43], "BLOAD", true, exec_cmd_bload, TOKEN_BLOAD);
+	BINDCMD(&ctx->cmds[44], "BSAVE", true, exec_cmd_bsave, TOKEN_BSAVE);
 }
 
 void exec_program(struct Context* ctx)
@@ -130,6 +157,8 @@ void exec_program(struct Context* ctx)
 	forstackidx = 0;
 	
 	var_clear_all(ctx);
+	sprite_reset();
+	chan_closeall();
 
 	while (ctx->running && currentNode != NULL)
 	{
@@ -144,6 +173,10 @@ void exec_program(struct Context* ctx)
 		exec_line(ctx);
 
 		free(ctx->tokenized_line);
+
+		// with one page, sprite changes show up as soon as the line is done
+		if (vga_pagecount == 1)
+			sprite_update();
 		
 		char ch = term_getchar();
 		
@@ -258,6 +291,39 @@ void handle_error(struct Context *ctx)
 		case ERR_ILLEGAL_DIRECT:
 			term_printf("\n?Illegal direct error");
 			break;
+		case ERR_OUT_OF_MEMORY:
+			term_printf("\n?Out of memory error");
+			break;
+		case ERR_ILLEGAL_QUANTITY:
+			term_printf("\n?Illegal quantity error");
+			break;
+		case ERR_FILE_OPEN:
+			term_printf("\n?File open error");
+			break;
+		case ERR_FILE_NOT_OPEN:
+			term_printf("\n?File not open error");
+			break;
+		case ERR_FILE_NOT_FOUND:
+			term_printf("\n?File not found error");
+			break;
+		case ERR_NOT_INPUT:
+			term_printf("\n?Not input file error");
+			break;
+		case ERR_NOT_OUTPUT:
+			term_printf("\n?Not output file error");
+			break;
+		case ERR_FILE_DATA:
+			term_printf("\n?File data error");
+			break;
+		case ERR_DISK:
+			term_printf("\n?Disk error");
+			break;
+		case ERR_BAD_SUBSCRIPT:
+			term_printf("\n?Bad subscript error");
+			break;
+		case ERR_REDIM:
+			term_printf("\n?Redim'd array error");
+			break;
 		default:
 			term_printf("\n?Unspecified error");
 			break;
@@ -272,6 +338,46 @@ void handle_error(struct Context *ctx)
 	}
 }
 
+bool is_fn_str(const unsigned char *s, int i)
+{
+	return i != -1 && strncmp((const char*)s + i, "STR$(", 5) == 0;
+}
+
+// STR$(x): format the numeric argument the way PRINT does into out
+int exec_fn_str(struct Context *ctx, int lpos, unsigned char *out)
+{
+	int open = lpos + 4;
+	int close = open;
+	int depth = 0;
+
+	// find the matching bracket so exec_expr stops at it
+	for (; ctx->tokenized_line[close] != 0; close++)
+	{
+		if (ctx->tokenized_line[close] == '(')
+			depth++;
+		else if (ctx->tokenized_line[close] == ')' && --depth == 0)
+			break;
+	}
+
+	if (ctx->tokenized_line[close] == 0)
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return close;
+	}
+
+	unsigned char saved = ctx->tokenized_line[close + 1];
+	ctx->tokenized_line[close + 1] = 0;
+	ctx->linePos = open;
+	exec_expr(ctx);
+	ctx->tokenized_line[close + 1] = saved;
+
+	if (ctx->error == ERR_NONE)
+		fmt_shorttoa((char*)out, ctx->dstack[ctx->dsptr--], FMT_SINGLE | FMT_CBM);
+
+	return close + 1;
+}
+
 int exec_strexpr(struct Context *ctx, int* len)
 {
 	unsigned char *exp;
@@ -325,6 +431,33 @@ int exec_strexpr(struct Context *ctx, int* len)
 				exp[ctr++] = ctx->tokenized_line[lpos++];
 		}
 		else 
+		if (is_fn_str(ctx->tokenized_line, lpos))
+		{
+			exp[ctr] = 0;
+			lpos = exec_fn_str(ctx, lpos, exp + ctr);
+			if (ctx->error != ERR_NONE)
+				break;
+			ctr = strlen((const char*)exp);
+
+			lpos = ignore_space(ctx->tokenized_line, lpos);
+
+			if (lpos == -1 || ensure_token(ctx->tokenized_line[lpos], 7, ':', ',', ';', '=', '<', '>', TOKEN_THEN))
+				break;
+
+			// expect plus sign
+			if (ensure_token(ctx->tokenized_line[lpos], 1, '+'))
+			{
+				lpos++;
+				lpos = ignore_space(ctx->tokenized_line, lpos);
+			}
+			else
+			{
+				ctx->error = ERR_UNEXP;
+				ctx->error_line = ctx->line;
+				break;
+			}
+		}
+		else
 		if (ISALPHA(ctx->tokenized_line[lpos]))
 		{
 			// check if variable
@@ -397,11 +530,25 @@ int exec_strexpr(struct Context *ctx, int* len)
 	return lpos;
 }
 
+// Add text to the expression being built in exec_expr. False when it would
+// not fit; numbers can be long once variables are replaced by them.
+static bool expr_append(unsigned char *exp, int *ctr, const char *text)
+{
+	int len = strlen(text);
+
+	if (*ctr + len >= EXPR_MAXLEN)
+		return false;
+
+	memcpy(exp + *ctr, text, len + 1);
+	*ctr += len;
+	return true;
+}
+
 int exec_expr(struct Context *ctx)
 {
-	unsigned char exp[200];
+	unsigned char exp[EXPR_MAXLEN];
 	unsigned char name[6];
-	char str_value[10];
+	char str_value[FMT_SHORTLEN];
 	int ctr = 0;
 	int lpos = ctx->linePos;
 	int expr_error = EXPR_ERR_NONE;
@@ -417,6 +564,32 @@ int exec_expr(struct Context *ctx)
 		{
 			lpos = get_symbol(ctx->tokenized_line, lpos, name);
 
+			// an array element
+			if (ctx->tokenized_line[lpos] == '(')
+			{
+				int index;
+				double value;
+
+				lpos = exec_subscript(ctx, lpos, &index);
+				if (ctx->error != ERR_NONE || !array_get(ctx, name, index, &value))
+				{
+					ctx->linePos = lpos;
+					return lpos;
+				}
+
+				if (name[length(name) - 1] == '%')
+					fmt_itoa(str_value, (int)value);
+				else
+					fmt_shorttoa(str_value, value, FMT_SINGLE | FMT_PLAIN);
+
+				if (!expr_append(exp, &ctr, str_value))
+				{
+					expr_error = EXPR_ERR_SYNTAX;
+					break;
+				}
+				continue;
+			}
+
 			for (int j = 0; j < ctx->var_count; j++)
 			{
 				if (compare(ctx->vars[j].name, name))
@@ -429,17 +602,16 @@ int exec_expr(struct Context *ctx)
 					if (ctx->vars[j].type == VAR_FLOAT)
 					{
 						double value = *((float*)ctx->vars[j].location);
-						snprintf(str_value, 10, "%f", value);
+						fmt_shorttoa(str_value, value, FMT_SINGLE | FMT_PLAIN);
 					}
 					if (ctx->vars[j].type == VAR_INT)
 					{
 						int value = *((int*)ctx->vars[j].location);
-						snprintf(str_value, 10, "%d", value);
+						fmt_itoa(str_value, value);
 					}
 
-					exp[ctr] = 0;
-					strcat((char*)exp, str_value);
-					ctr = strlen((const char*)exp);
+					if (!expr_append(exp, &ctr, str_value))
+						expr_error = EXPR_ERR_SYNTAX;
 					varFound = 1;
 					break;
 				}
@@ -458,16 +630,24 @@ int exec_expr(struct Context *ctx)
 				else
 					var_add_update_float(ctx, name, ctx->dstack[ctx->dsptr--]);
 				
-				double value = 0;
-
-				snprintf(str_value, 10, "%f", value);
-				exp[ctr] = 0;
-				strcat((char*)exp, str_value);
-				ctr = strlen((const char*)exp);
+				str_value[0] = '0';
+				str_value[1] = 0;
+				if (!expr_append(exp, &ctr, str_value))
+				{
+					expr_error = EXPR_ERR_SYNTAX;
+					break;
+				}
 			}
+			else if (expr_error != EXPR_ERR_NONE)
+				break;
 		}
-		else
+		else if (ctr < EXPR_MAXLEN - 1)
 			exp[ctr++] = ctx->tokenized_line[lpos++];
+		else
+		{
+			expr_error = EXPR_ERR_SYNTAX;
+			break;
+		}
 	}
 
 	exp[ctr] = 0;
@@ -508,18 +688,109 @@ int exec_expr(struct Context *ctx)
 
 }
 
+// DIM A(n)[,B%(n)...] makes arrays of n + 1 numbers. DIM A(n) FILE "name"
+// keeps the array in a file instead, read and written through a page cache,
+// so it can be much larger than memory.
 void exec_cmd_dim(struct Context *ctx)
 {
-	unsigned char name[VAR_NAMESZ];
+	unsigned char name[VAR_NAMESZ + 3];
+	char fnbuffer[FILENAME_SZ + 1];
+	int size;
 
-	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
-	ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
-	exec_expr(ctx);
-	//var_add_update(ctx, name, 0, ctx->dstack[ctx->dsptr--], 0);
+	while (true)
+	{
+		const char *file = NULL;
+
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		if (ctx->linePos == -1 || !ISALPHA(ctx->tokenized_line[ctx->linePos]))
+		{
+			ctx->error = ERR_UNEXP;
+			ctx->error_line = ctx->line;
+			return;
+		}
+
+		ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
+		if (ctx->tokenized_line[ctx->linePos] != '(')
+		{
+			ctx->error = ERR_UNEXP;
+			ctx->error_line = ctx->line;
+			return;
+		}
+
+		ctx->linePos = exec_subscript(ctx, ctx->linePos, &size);
+		if (ctx->error != ERR_NONE)
+			return;
+
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		if (ctx->linePos != -1 && strncmp((const char*)ctx->tokenized_line + ctx->linePos, "FILE", 4) == 0)
+		{
+			ctx->linePos += 4;
+			if (!get_quoted(ctx, fnbuffer, FILENAME_SZ))
+				return;
+			to_uppercase((unsigned char *)fnbuffer);
+			file = fnbuffer;
+
+			ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		}
+
+		if (array_dim(ctx, name, size, file) == NULL)
+			return;
+
+		if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != ',')
+			break;
+		ctx->linePos++;
+	}
+
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+	}
 }
 
 void exec_cmd_dir(struct Context *ctx)
 {
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && strncmp((const char*)ctx->tokenized_line + ctx->linePos, "STATS", 5) == 0)
+	{
+		ctx->linePos += 5;
+
+		// SD command latencies and cache counts since the last DIR STATS
+		term_printf("\ncmd  count  median     max\n");
+		for (u32 cmd = 0; cmd < 64; cmd++)
+		{
+			u32 buckets[EMMC_LATENCY_BUCKETS];
+			u32 count = 0, seen = 0, median = 0, max = 0;
+
+			disk_getlatency(cmd, buckets);
+			for (u32 b = 0; b < EMMC_LATENCY_BUCKETS; b++)
+				count += buckets[b];
+			if (count == 0)
+				continue;
+
+			for (u32 b = 0; b < EMMC_LATENCY_BUCKETS; b++)
+			{
+				if (buckets[b] == 0)
+					continue;
+				if (seen * 2 < count)
+					median = b;
+				seen += buckets[b];
+				max = b;
+			}
+
+			// each bucket is shown as its upper bound in microseconds
+			term_printf("%3u %6u %5uus %5uus\n", cmd, count, 1 << median, 1 << max);
+		}
+
+		DISK_CACHESTATS cache;
+		disk_getcachestats(&cache);
+		term_printf("cache %u hits %u misses %u read ahead %u written\n",
+			(u32)cache.hits, (u32)cache.misses, (u32)cache.readahead, (u32)cache.writebacks);
+
+		disk_resetstats();
+		return;
+	}
+
 	term_printf("\nFiles:\n");
 	
 	DIR dir;
@@ -918,20 +1189,29 @@ again:
 void exec_cmd_let(struct Context *ctx)
 {
 	unsigned char name[VAR_NAMESZ+2]; // 2 chars, var type, \0
-	int j = 0;
+	int index = -1;
 	int len = 0;
 
 	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
 	ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
-	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
 
-	if (ctx->tokenized_line[ctx->linePos] == '[')
+	// an array element
+	if (ctx->tokenized_line[ctx->linePos] == '(')
 	{
-		ctx->linePos = exec_expr(ctx);
-		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
-		j = ctx->dstack[ctx->dsptr--];
+		if (name[length(name) - 1] == '$')
+		{
+			ctx->error = ERR_TYPE_MISMATCH;
+			ctx->error_line = ctx->line;
+			return;
+		}
+
+		ctx->linePos = exec_subscript(ctx, ctx->linePos, &index);
+		if (ctx->error != ERR_NONE)
+			return;
 	}
 
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+
 	// anything after token must be equal sign
 	if (ensure_token(ctx->tokenized_line[ctx->linePos], 1, '='))
 	{
@@ -952,7 +1232,9 @@ void exec_cmd_let(struct Context *ctx)
 			return;
 		}
 
-		if (name[length(name) - 1] == '%')
+		if (index >= 0)
+			array_set(ctx, name, index, ctx->dstack[ctx->dsptr--]);
+		else if (name[length(name) - 1] == '%')
 			var_add_update_int(ctx, name, ctx->dstack[ctx->dsptr--]);
 		else if (name[length(name) - 1] == '$')
 			var_add_update_string(ctx, name, ctx->strPtr, len);
@@ -967,52 +1249,161 @@ void exec_cmd_let(struct Context *ctx)
 	}
 }
 
+// LIST [first][-[last]] [PAGE]
+// Lines are copied into one buffer a screenful at a time and written out in
+// one go, so the terminal scrolls and draws once per page. A key pressed
+// between pages pauses the listing, ESC stops it, and PAGE waits for a key
+// after every page.
 void exec_cmd_list(struct Context *ctx)
 {
-	ll_sort();
+	int first = 0, last = 0x7FFFFFFF;
+	bool page = false;
+	int pos = ignore_space(ctx->tokenized_line, ctx->linePos);
+
+	if (pos != -1 && ISDIGIT(ctx->tokenized_line[pos]))
+	{
+		pos = get_int(ctx->tokenized_line, pos, &first);
+		last = first;
+		pos = ignore_space(ctx->tokenized_line, pos);
+	}
+
+	if (pos != -1 && ctx->tokenized_line[pos] == '-')
+	{
+		last = 0x7FFFFFFF;
+		pos = ignore_space(ctx->tokenized_line, pos + 1);
+		if (pos != -1 && ISDIGIT(ctx->tokenized_line[pos]))
+		{
+			pos = get_int(ctx->tokenized_line, pos, &last);
+			pos = ignore_space(ctx->tokenized_line, pos);
+		}
+	}
+
+	if (pos != -1 && strncmp((const char*)ctx->tokenized_line + pos, "PAGE", 4) == 0)
+	{
+		page = true;
+		pos = ignore_space(ctx->tokenized_line, pos + 4);
+	}
+
+	if (pos != -1 && ctx->tokenized_line[pos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+	ctx->linePos = pos;
+
+	u32 rows = term_rows();
+	u32 cols = term_cols();
+	u32 pagerows = rows > 1 ? rows - 1 : 1;
+
+	// a full page plus the line held over from the last one, which on a
+	// small screen can be longer than a page, plus the line being added
+	char *buf = (char*)malloc((rows * cols) + (2 * (FMT_MAXLEN + 162)));
+	if (buf == NULL)
+	{
+		ctx->error = ERR_OUT_OF_MEMORY;
+		ctx->error_line = ctx->line;
+		return;
+	}
 
-	struct node *ptr = ll_gethead();
-	term_printf("\n");
+	struct node *ptr = ll_seek(first);
+	u32 used = 0, usedrows = 1;
+	buf[used++] = '\n';
 
-	//start from the beginning
-	while (ptr != NULL)
+	while (ptr != NULL && ptr->linenum <= last)
 	{
-		char lnbuff[10] = { 0 };
-		snprintf(lnbuff, sizeof(lnbuff), "%d", ptr->linenum);
-		term_printf("%s %s\n", lnbuff, ptr->data);
+		u32 start = used;
+
+		used += fmt_itoa(&buf[used], ptr->linenum);
+		buf[used++] = ' ';
+		u32 len = strlen((const char*)ptr->data);
+		memcpy(&buf[used], ptr->data, len);
+		used += len;
+		buf[used++] = '\n';
+
+		// a line exactly as wide as the screen wraps before its newline
+		u32 linerows = ((used - start - 1) / cols) + 1;
+		if (usedrows + linerows <= pagerows)
+		{
+			usedrows += linerows;
+			ptr = ptr->next;
+			continue;
+		}
+
+		// the page is full: show it, keeping this line for the next one
+		term_write(buf, start);
+		memmove(buf, &buf[start], used - start);
+		used -= start;
+		usedrows = linerows;
 		ptr = ptr->next;
+
+		uint8_t ch = term_getchar();
+		if (ch != 27 && (page || ch != 0))
+			while ((ch = term_getchar()) == 0)
+				;
+
+		if (ch == 27)
+		{
+			used = 0;
+			ctx->error = ERR_BREAK;
+			ctx->error_line = ctx->line;
+			break;
+		}
 	}
+
+	term_write(buf, used);
+	free(buf);
 }
 
-void exec_cmd_load(struct Context *ctx)
+// Store one line of a file being loaded: the line number, then the text
+void load_line(const char *text, int len)
 {
-	FIL fp;
-	FRESULT res;
-	UINT bytesRead;
-	BYTE b[2];
-	char buffer[160];
-	int bufferCtr = 0;
 	int linenum = 0;
-	int dataPtr = 0;
-	char fnbuffer[20] = {0};
-	
+	int i = 0;
+
+	if (len > 0 && text[len - 1] == '\r')
+		len--;
+	if (len > LOAD_LINEMAX)
+		len = LOAD_LINEMAX;
+
+	while (i < len && ISDIGIT(text[i]))
+		linenum = (linenum * 10) + (text[i++] - '0');
+	while (i < len && text[i] == ' ')
+		i++;
+
+	if (i == len)
+		return;
+
+	unsigned char *data = (unsigned char *)malloc(len - i + 1);
+	if (data == NULL)
+		return;
+	memcpy(data, text + i, len - i);
+	data[len - i] = 0;
+
+	ll_insertLast(linenum, data);
+}
+
+// a quoted string of up to size characters; anything past that is dropped
+bool get_quoted(struct Context *ctx, char *buffer, int size)
+{
+	int bufferCtr = 0;
+
 	// skip spaces
 	ctx->linePos = ignore_space(ctx->tokenized_line,ctx->linePos);
 	
 	// expect quote
-	if(ctx->tokenized_line[ctx->linePos] != '\"')
+	if(ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != '\"')
 	{
 		ctx->error = ERR_UNEXP;
 		ctx->error_line = ctx->line;
-		return;
+		return false;
 	}
 	ctx->linePos++;
 	while(ctx->tokenized_line[ctx->linePos] != 0 && ctx->tokenized_line[ctx->linePos] != '\"')
 	{
-		fnbuffer[bufferCtr++] = ctx->tokenized_line[ctx->linePos++];
-	
-		if(bufferCtr == 15)
-			ctx->tokenized_line[ctx->linePos] = '\"';
+		if(bufferCtr < size)
+			buffer[bufferCtr++] = ctx->tokenized_line[ctx->linePos];
+		ctx->linePos++;
 	}
 
 	// expect closing quote
@@ -1020,75 +1411,194 @@ void exec_cmd_load(struct Context *ctx)
 	{
 		ctx->error = ERR_UNEXP;
 		ctx->error_line = ctx->line;
-		return;
+		return false;
 	}
+	ctx->linePos++;
 	
-	fnbuffer[bufferCtr++] = '.';
-	fnbuffer[bufferCtr++] = 'B';
-	fnbuffer[bufferCtr++] = 'A';
-	fnbuffer[bufferCtr++] = 'S';
-	fnbuffer[bufferCtr] = 0;
+	buffer[bufferCtr] = 0;
+	return true;
+}
+
+// Read "name" from the statement into fnbuffer, adding .BAS when the name
+// has no extension of its own. Returns false after a syntax error.
+bool get_filename(struct Context *ctx, char *fnbuffer)
+{
+	if (!get_quoted(ctx, fnbuffer, FILENAME_SZ))
+		return false;
+
+	if(strchr(fnbuffer, '.') == NULL)
+		strcat(fnbuffer, ".BAS");
 	
 	to_uppercase((unsigned char *)fnbuffer);
-	
-	bufferCtr = 0;
-	
-	// new cmd
-	while(!ll_isEmpty())
-		ll_deleteFirst();
+	return true;
+}
 
-	//snprintf(fnbuffer, sizeof(fnbuffer), "%s.BAS", filename);
-	
-	term_printf("Searching for %s\n", fnbuffer);
-	
-	res = f_open(&fp, fnbuffer, FA_READ | FA_OPEN_EXISTING);
-	
-	if (res == FR_OK)
+// a .PRG file holds the program image rather than its text
+bool is_prg(const char *fnbuffer)
+{
+	const char *ext = strrchr(fnbuffer, '.');
+	return ext != NULL && strcmp(ext, ".PRG") == 0;
+}
+
+// FNV-1a over the part of a .PRG image after its header
+unsigned int prg_checksum(const unsigned char *data, unsigned int len)
+{
+	unsigned int hash = 2166136261u;
+
+	while (len--)
 	{
-		term_printf("Loading");
-		
-		while (true) 
+		hash ^= *data++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+FRESULT load_text(FIL *fp)
+{
+	FRESULT res;
+	UINT bytesRead;
+	char line[LOAD_LINEMAX + 1];
+	int lineLen = 0;
+
+	// word aligned so FatFs can hand whole sectors to the card
+	u32 *chunk = (u32*)malloc(LOAD_CHUNK);
+	if (chunk == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	// lines are taken straight out of each chunk; only one that runs
+	// over into the next chunk is put together in line[]
+	while ((res = f_read(fp, chunk, LOAD_CHUNK, &bytesRead)) == FR_OK && bytesRead != 0)
+	{
+		char *ptr = (char*)chunk;
+		char *end = ptr + bytesRead;
+
+		while (ptr < end)
 		{
-			res = f_read(&fp, b, 1, &bytesRead);
-			
-			if(res == FR_OK && bytesRead == 1)
-			{
-				if(b[0] != '\n')
-					buffer[bufferCtr++] = b[0];
-				else 
-				{
-					if(bufferCtr != 0)
-					{
-						buffer[bufferCtr] = 0;
-						dataPtr = get_int((unsigned char *)buffer, 0, &linenum);
-						dataPtr = ignore_space((unsigned char *)buffer, dataPtr);
-						memcpy(buffer, buffer + dataPtr, strlen(buffer)+dataPtr);						
-						char *data = (char *)malloc(sizeof(char) * strlen(buffer) + 1);
-						memcpy(data, buffer, strlen(buffer) + 1);
-						ll_insertFirst(linenum, (unsigned char *)data);
-						bufferCtr=0;
-					}
-				}
-			}
+			char *nl = (char*)memchr(ptr, '\n', end - ptr);
+			char *stop = nl ? nl : end;
+
+			if (nl && lineLen == 0)
+				load_line(ptr, nl - ptr);
 			else
 			{
-				if(bufferCtr != 0)
+				int n = stop - ptr;
+				if (n > LOAD_LINEMAX - lineLen)
+					n = LOAD_LINEMAX - lineLen;
+				memcpy(line + lineLen, ptr, n);
+				lineLen += n;
+
+				if (nl)
 				{
-					buffer[bufferCtr] = 0;
-					dataPtr = get_int((unsigned char *)buffer, 0, &linenum);
-					dataPtr = ignore_space((unsigned char *)buffer, dataPtr);
-					memcpy(buffer, buffer + dataPtr, strlen(buffer)+dataPtr);
-					char *data = (char *)malloc(sizeof(char) * strlen(buffer) + 1);
-					memcpy(data, buffer, strlen(buffer) + 1);
-					ll_insertFirst(linenum, (unsigned char *)data);
-					bufferCtr=0;
+					load_line(line, lineLen);
+					lineLen = 0;
 				}
-				break;
 			}
-		};
 
-		ll_sort();
+			ptr = nl ? nl + 1 : end;
+		}
+	}
+
+	if (lineLen != 0)
+		load_line(line, lineLen);
+
+	free(chunk);
+	return res;
+}
+
+// The whole file is read in one go. Each line's length comes from the index,
+// so there is nothing to scan or parse; lines are only copied out.
+FRESULT load_prg(FIL *fp)
+{
+	FRESULT res;
+	UINT bytesRead;
+	UINT size = f_size(fp);
+
+	if (size < sizeof(struct prgheader))
+		return FR_INVALID_OBJECT;
+
+	unsigned char *image = (unsigned char*)malloc(size);
+	if (image == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	res = f_read(fp, image, size, &bytesRead);
+	if (res == FR_OK && bytesRead != size)
+		res = FR_INT_ERR;
+
+	struct prgheader *header = (struct prgheader*)image;
+	struct prgline *index = (struct prgline*)(header + 1);
+	char *text = (char*)(index + header->lines);
+
+	if (res == FR_OK
+		&& (header->magic != PRG_MAGIC
+			|| header->lines > size / sizeof(struct prgline)
+			|| sizeof(struct prgheader) + (header->lines * sizeof(struct prgline)) + header->textsize != size
+			|| header->checksum != prg_checksum(image + sizeof(struct prgheader), size - sizeof(struct prgheader))))
+		res = FR_INVALID_OBJECT;
+
+	for (unsigned int i = 0; i < header->lines && res == FR_OK; i++)
+	{
+		unsigned int start = index[i].offset;
+		unsigned int end = i + 1 < header->lines ? index[i + 1].offset : header->textsize;
+
+		// each line is stored with its terminating zero, and is no longer
+		// than a line LOAD takes from text, which the rest of the
+		// interpreter sizes its buffers for
+		if (start >= end || end > header->textsize || end - start > LOAD_LINEMAX + 1
+			|| text[end - 1] != 0)
+		{
+			res = FR_INVALID_OBJECT;
+			break;
+		}
+
+		unsigned char *data = (unsigned char*)malloc(end - start);
+		if (data == NULL)
+		{
+			res = FR_NOT_ENOUGH_CORE;
+			break;
+		}
+		memcpy(data, text + start, end - start);
+		ll_insertLast(index[i].linenum, data);
+	}
+
+	free(image);
+	return res;
+}
+
+void exec_cmd_load(struct Context *ctx)
+{
+	FIL fp;
+	FRESULT res;
+	char fnbuffer[FILENAME_SZ + 5] = {0};
+	
+	if (!get_filename(ctx, fnbuffer))
+		return;
+	
+	// new cmd
+	while(!ll_isEmpty())
+		ll_deleteFirst();
+	
+	term_printf("Searching for %s\n", fnbuffer);
+	
+	res = f_open(&fp, fnbuffer, FA_READ | FA_OPEN_EXISTING);
+	
+	if (res == FR_OK)
+	{
+		term_printf("Loading");
+
+		res = is_prg(fnbuffer) ? load_prg(&fp) : load_text(&fp);
 		f_close(&fp);
+
+		// a file saved by SAVE is in order already, and then this does nothing
+		ll_sort();
+
+		if (res == FR_NOT_ENOUGH_CORE)
+		{
+			ctx->error = ERR_OUT_OF_MEMORY;
+			ctx->error_line = ctx->line;
+		}
+		else if (res != FR_OK)
+			term_printf("\n?File load error #%d", res);
 	}
 	else
 		term_printf("?File load error #%d", res);
@@ -1100,6 +1610,7 @@ void exec_cmd_new(struct Context *ctx)
 		ll_deleteFirst();
 
 	var_clear_all(ctx);
+	chan_closeall();
 }
 
 void exec_cmd_next(struct Context *ctx)
@@ -1196,191 +1707,1236 @@ void exec_cmd_next(struct Context *ctx)
 			}
 		}
 
-		if (found == false)
+		if (found == false)
+		{
+			// next without for
+			ctx->error = ERR_NEXT_WO_FOR;
+			ctx->error_line = ctx->line;
+		}
+	}
+	else
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+	}
+
+	free(tkn.token);
+}
+
+void exec_cmd_print(struct Context *ctx)
+{
+	print_items(ctx, 0);
+}
+
+// PRINT output goes to the screen, or to channel ch
+void print_out(struct Context *ctx, int ch, const char *text, int len)
+{
+	if (ch == 0)
+		term_putn(text, len);
+	else if (ctx->error == ERR_NONE)
+		file_error(ctx, chan_write(ch, text, len));
+}
+
+// The items of a PRINT or PRINT#. Returns whether the line was ended, rather
+// than left open by a ; or , after the last item.
+bool print_items(struct Context *ctx, int ch)
+{
+	bool eol = true;
+	unsigned char val[200];
+
+	while (true)
+	{
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+
+		if (ctx->linePos == -1 || ensure_token(ctx->tokenized_line[ctx->linePos], 1, ':'))
+			break;
+
+		eol = true;
+		ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, val);
+
+		// print string expression
+		if (val[length(val) - 1] == '$' || val[0] == '\"' || is_fn_str(ctx->tokenized_line, ctx->linePos - length(val)))
+		{
+			ctx->linePos = ctx->linePos - length(val);
+			int len = 0;
+			ctx->linePos = exec_strexpr(ctx, &len);
+			if (ctx->error == ERR_NONE)
+			{
+				print_out(ctx, ch, (const char*)ctx->strPtr, len);
+				free(ctx->strPtr);
+			}	
+			else
+				break;
+		}
+		else
+		{
+			// print numeric expression
+			ctx->linePos = ctx->linePos - length(val);
+			ctx->linePos = exec_expr(ctx);
+			if (ctx->error == ERR_NONE)
+			{
+				char num[FMT_SHORTLEN];
+				int len = fmt_shorttoa(num, ctx->dstack[ctx->dsptr--], FMT_SINGLE | FMT_CBM);
+				print_out(ctx, ch, num, len);
+			}
+			else
+				break;
+		}
+
+		if (ctx->linePos == -1 || ctx->error != ERR_NONE)
+			break;
+
+		if (ctx->tokenized_line[ctx->linePos] == ';')
+		{
+			ctx->linePos++;
+			eol = false;
+		}
+		else if (ctx->tokenized_line[ctx->linePos] == ',')
+		{
+			// a file gets the comma itself, so INPUT# reads the items back one by one
+			ctx->linePos++;
+			if (ch == 0)
+				print_out(ctx, ch, "     ", 5);
+			else
+				print_out(ctx, ch, ",", 1);
+			eol = false;
+		}
+	}
+
+	if (eol && ctx->error == ERR_NONE)
+		print_out(ctx, ch, "\n", 1);
+
+	return eol;
+}
+
+void exec_cmd_rem(struct Context *ctx)
+{
+	// skip this line (do nothing)
+	ctx->linePos = -1;
+	return;
+}
+
+void exec_cmd_return(struct Context *ctx)
+{
+	if (ctx->csptr == 0)
+	{
+		ctx->error = ERR_RTRN_WO_GSB;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	// release current line resource
+	free(ctx->tokenized_line);
+	
+	// Get previous line pos and line number from stack
+	ctx->linePos = ctx->cstack[ctx->csptr--];
+	ctx->line = ll_find(ctx->cstack[ctx->csptr])->linenum;
+	ctx->original_line = ll_find(ctx->cstack[ctx->csptr--])->data;
+	
+	// retokenize the line
+	unsigned char* tokenized_line = (unsigned char*)malloc(sizeof(unsigned char)*160);
+	tokenize(ctx, ctx->original_line, tokenized_line);
+
+	ctx->tokenized_line = tokenized_line;
+	ctx->jmpline = ctx->line;
+}
+
+void exec_cmd_run(struct Context *ctx)
+{
+	exec_program(ctx);
+
+	// what the program wrote to channels it left open and to file arrays
+	// goes to the card now
+	FRESULT res = chan_sync();
+	FRESULT arrayRes = farray_sync();
+	file_error(ctx, res != FR_OK ? res : arrayRes);
+	handle_error(ctx);
+
+	// back to a single page so Ready. lands on the visible one
+	vga_setpages(1);
+
+	ctx->linePos = -1;
+	return;
+}
+
+FRESULT save_text(FIL *fp)
+{
+	FRESULT res = FR_OK;
+
+	// the exact size, so the file can be given contiguous clusters
+	char num[FMT_MAXLEN + 2];
+	FSIZE_t size = 0;
+	for (struct node *ptr = ll_gethead(); ptr != NULL; ptr = ptr->next)
+		size += fmt_itoa(num, ptr->linenum) + 1 + strlen((const char*)ptr->data) + 1;
+
+	// no run of free clusters that long is not an error, just slower
+	f_expand(fp, size, 1);
+
+	// word aligned, and a whole number of sectors until the last write
+	char *chunk = (char*)malloc(SAVE_CHUNK);
+	UINT used = 0, written;
+
+	if (chunk == NULL)
+		res = FR_NOT_ENOUGH_CORE;
+
+	for (struct node *ptr = ll_gethead(); ptr != NULL && res == FR_OK; ptr = ptr->next)
+	{
+		UINT len = fmt_itoa(num, ptr->linenum);
+		num[len++] = ' ';
+		UINT datalen = strlen((const char*)ptr->data);
+		const char *parts[3] = { num, (const char*)ptr->data, "\n" };
+		UINT lens[3] = { len, datalen, 1 };
+
+		for (int p = 0; p < 3 && res == FR_OK; p++)
+		{
+			const char *src = parts[p];
+			UINT n = lens[p];
+
+			while (n > 0 && res == FR_OK)
+			{
+				UINT room = SAVE_CHUNK - used;
+				UINT take = n < room ? n : room;
+
+				memcpy(chunk + used, src, take);
+				used += take;
+				src += take;
+				n -= take;
+
+				if (used == SAVE_CHUNK)
+				{
+					res = f_write(fp, chunk, used, &written);
+					if (res == FR_OK && written != used)
+						res = FR_DENIED;
+					used = 0;
+				}
+			}
+		}
+	}
+
+	if (res == FR_OK && used != 0)
+	{
+		res = f_write(fp, chunk, used, &written);
+		if (res == FR_OK && written != used)
+			res = FR_DENIED;
+	}
+
+	free(chunk);
+	return res;
+}
+
+// header, line index and text are built in memory and written in one go
+FRESULT save_prg(FIL *fp)
+{
+	FRESULT res;
+	UINT written;
+	unsigned int lines = 0, textsize = 0;
+
+	for (struct node *ptr = ll_gethead(); ptr != NULL; ptr = ptr->next)
+	{
+		lines++;
+		textsize += strlen((const char*)ptr->data) + 1;
+	}
+
+	UINT size = sizeof(struct prgheader) + (lines * sizeof(struct prgline)) + textsize;
+	unsigned char *image = (unsigned char*)malloc(size);
+	if (image == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	struct prgheader *header = (struct prgheader*)image;
+	struct prgline *index = (struct prgline*)(header + 1);
+	char *text = (char*)(index + lines);
+	unsigned int offset = 0;
+
+	for (struct node *ptr = ll_gethead(); ptr != NULL; ptr = ptr->next, index++)
+	{
+		unsigned int len = strlen((const char*)ptr->data) + 1;
+
+		index->linenum = ptr->linenum;
+		index->offset = offset;
+		memcpy(text + offset, ptr->data, len);
+		offset += len;
+	}
+
+	header->magic = PRG_MAGIC;
+	header->lines = lines;
+	header->textsize = textsize;
+	header->checksum = prg_checksum(image + sizeof(struct prgheader), size - sizeof(struct prgheader));
+
+	f_expand(fp, size, 1);
+	res = f_write(fp, image, size, &written);
+	if (res == FR_OK && written != size)
+		res = FR_DENIED;
+
+	free(image);
+	return res;
+}
+
+void exec_cmd_save(struct Context *ctx)
+{
+	FIL fp;
+	FRESULT res;
+	char fnbuffer[FILENAME_SZ + 5] = {0};
+
+	if (!get_filename(ctx, fnbuffer))
+		return;
+
+	// the program goes to a temporary file first, so the old copy survives
+	// anything that goes wrong before the rename
+	res = f_open(&fp, SAVE_TEMPNAME, FA_WRITE | FA_CREATE_ALWAYS);
+	
+	if (res == FR_OK)
+	{
+		term_printf("Saving %s", fnbuffer);
+		
+		ll_sort();
+		res = is_prg(fnbuffer) ? save_prg(&fp) : save_text(&fp);
+
+		FRESULT closeRes = f_close(&fp);
+		if (res == FR_OK)
+			res = closeRes;
+
+		// FAT cannot rename over a file, so the old one goes just before
+		if (res == FR_OK)
+		{
+			res = f_unlink(fnbuffer);
+			if (res == FR_NO_FILE)
+				res = FR_OK;
+		}
+		if (res == FR_OK)
+		{
+			// the old copy is gone now, so if this fails the temporary file
+			// is the only one left and has to stay
+			res = f_rename(SAVE_TEMPNAME, fnbuffer);
+			if (res != FR_OK)
+				term_printf("\n?File Save Error #%d, program kept in %s", res, SAVE_TEMPNAME);
+		}
+		else
+		{
+			f_unlink(SAVE_TEMPNAME);
+			term_printf("\n?File Save Error #%d", res);
+		}
+	}
+	else
+		term_printf("?File Save Error #%d", res);
+}
+
+// turn a FatFs result into a BASIC error
+void file_error(struct Context *ctx, FRESULT res)
+{
+	switch (res)
+	{
+	case FR_OK:
+		return;
+	case FR_NO_FILE:
+	case FR_NO_PATH:
+	case FR_INVALID_NAME:
+		ctx->error = ERR_FILE_NOT_FOUND;
+		break;
+	case FR_INVALID_PARAMETER:
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		break;
+	case FR_NOT_ENOUGH_CORE:
+		ctx->error = ERR_OUT_OF_MEMORY;
+		break;
+	default:
+		ctx->error = ERR_DISK;
+		break;
+	}
+
+	ctx->error_line = ctx->line;
+}
+
+bool check_channel(struct Context *ctx, int n)
+{
+	if (n < 1 || n > CHAN_MAX)
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+	else if (!chan_isopen(n))
+		ctx->error = ERR_FILE_NOT_OPEN;
+	else
+		return true;
+
+	ctx->error_line = ctx->line;
+	return false;
+}
+
+// the number of an open channel, or 0 with ctx->error set
+int get_channel(struct Context *ctx)
+{
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos == -1)
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return 0;
+	}
+
+	ctx->linePos = exec_expr(ctx);
+	if (ctx->error != ERR_NONE)
+		return 0;
+	if (ctx->linePos != -1)
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+
+	int n = (int)ctx->dstack[ctx->dsptr--];
+	return check_channel(ctx, n) ? n : 0;
+}
+
+// OPEN n,"file"[,R|W|A|L[,length]]
+// R reads an existing file and is the default, W replaces the file, A adds to
+// the end of it and L opens it for records of the given length, read and
+// written in any order.
+void exec_cmd_open(struct Context *ctx)
+{
+	char fnbuffer[FILENAME_SZ + 1];
+	int mode = CHAN_READ;
+	int reclen = 0;
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos == -1)
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	ctx->linePos = exec_expr(ctx);
+	if (ctx->error != ERR_NONE)
+		return;
+	int n = (int)ctx->dstack[ctx->dsptr--];
+
+	if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != ',')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+	ctx->linePos++;
+
+	if (!get_quoted(ctx, fnbuffer, FILENAME_SZ))
+		return;
+	to_uppercase((unsigned char *)fnbuffer);
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == ',')
+	{
+		const char *modes = "RWAL";
+		const char *m = NULL;
+
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos + 1);
+		if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != 0 && !ISALPHA(ctx->tokenized_line[ctx->linePos + 1]))
+			m = strchr(modes, ctx->tokenized_line[ctx->linePos]);
+
+		if (m == NULL)
+		{
+			ctx->error = ERR_UNEXP;
+			ctx->error_line = ctx->line;
+			return;
+		}
+
+		mode = m - modes;
+		ctx->linePos++;
+
+		if (mode == CHAN_RECORD)
+		{
+			ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+			if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != ',')
+			{
+				ctx->error = ERR_UNEXP;
+				ctx->error_line = ctx->line;
+				return;
+			}
+			ctx->linePos++;
+
+			if (exec_exprlist(ctx, &reclen, 1, 1) < 0)
+				return;
+		}
+	}
+
+	ctx->linePos = ctx->linePos == -1 ? -1 : ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	if (n < 1 || n > CHAN_MAX || (mode == CHAN_RECORD && (reclen < 1 || reclen > CHAN_RECMAX)))
+	{
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	if (chan_isopen(n))
+	{
+		ctx->error = ERR_FILE_OPEN;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	file_error(ctx, chan_open(n, fnbuffer, mode, reclen));
+}
+
+// CLOSE n, or CLOSE on its own for every channel. Closing a channel that is
+// not open does nothing.
+void exec_cmd_close(struct Context *ctx)
+{
+	int n;
+	int count = exec_exprlist(ctx, &n, 0, 1);
+
+	if (count < 0)
+		return;
+
+	if (count == 0)
+	{
+		FRESULT res = chan_sync();
+		chan_closeall();
+		file_error(ctx, res);
+	}
+	else if (n < 1 || n > CHAN_MAX)
+	{
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
+	}
+	else if (chan_isopen(n))
+		file_error(ctx, chan_close(n));
+}
+
+// PRINT# n[,items] prints to a channel. On a record channel the record is
+// filled out with zeros afterwards, unless the items end with ; or , and more
+// is to be added to it.
+void exec_cmd_print_dev(struct Context *ctx)
+{
+	int n = get_channel(ctx);
+	if (n == 0)
+		return;
+
+	if (chan_mode(n) == CHAN_READ)
+	{
+		ctx->error = ERR_NOT_OUTPUT;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == ',')
+		ctx->linePos++;
+	else if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	bool eol = print_items(ctx, n);
+
+	if (eol && ctx->error == ERR_NONE && chan_mode(n) == CHAN_RECORD)
+		file_error(ctx, chan_endrecord(n));
+}
+
+// One INPUT# item: leading spaces are skipped, and it ends at a comma or a
+// line end outside quotes. *end is set if the file (or record) ran out.
+FRESULT input_field(int ch, unsigned char *field, int size, bool *end)
+{
+	bool quoted = false;
+	int len = 0;
+	int c;
+	FRESULT res;
+
+	while ((res = chan_getc(ch, &c)) == FR_OK && c != -1)
+	{
+		if (c == '\"')
+			quoted = !quoted;
+		else if (!quoted && (c == ',' || c == '\n'))
+			break;
+		else if (!quoted && (c == '\r' || (c == ' ' && len == 0)))
+			continue;
+		else if (len < size - 1)
+			field[len++] = c;
+	}
+
+	field[len] = 0;
+	*end = c == -1;
+	return res;
+}
+
+// INPUT# n,var[,var...] reads items from a channel. ST is 64 once the end of
+// the file, or of the record, has been reached and 0 before that.
+void exec_cmd_input_dev(struct Context *ctx)
+{
+	unsigned char name[VAR_NAMESZ + 3];
+	unsigned char field[160];
+	bool end = false;
+	int count = 0;
+
+	int n = get_channel(ctx);
+	if (n == 0)
+		return;
+
+	if (chan_mode(n) == CHAN_WRITE || chan_mode(n) == CHAN_APPEND)
+	{
+		ctx->error = ERR_NOT_INPUT;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	while (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == ',')
+	{
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos + 1);
+		if (ctx->linePos == -1 || !ISALPHA(ctx->tokenized_line[ctx->linePos]))
+		{
+			count = 0;
+			break;
+		}
+		ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
+
+		FRESULT res = input_field(n, field, sizeof(field), &end);
+		if (res != FR_OK)
+		{
+			file_error(ctx, res);
+			return;
+		}
+
+		if (name[length(name) - 1] == '$')
+			var_add_update_string(ctx, name, field, length(field));
+		else
+		{
+			char *last;
+			int len = length(field);
+
+			while (len > 0 && field[len - 1] == ' ')
+				field[--len] = 0;
+
+			double value = strtod((const char*)field, &last);
+			if (*last != 0)
+			{
+				ctx->error = ERR_FILE_DATA;
+				ctx->error_line = ctx->line;
+				return;
+			}
+
+			if (name[length(name) - 1] == '%')
+				var_add_update_int(ctx, name, (int)value);
+			else
+				var_add_update_float(ctx, name, value);
+		}
+
+		count++;
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	}
+
+	// at least one variable, and nothing after the last one
+	if (count == 0 || (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':'))
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	var_add_update_float(ctx, (const unsigned char*)"ST", end || chan_eof(n) ? 64 : 0);
+}
+
+// GET var takes a key if one has been pressed, without waiting, and GET# n,var
+// the next character of a channel. Either gives "" when there is none.
+void exec_cmd_get(struct Context *ctx)
+{
+	unsigned char name[VAR_NAMESZ + 3];
+	unsigned char value[2] = { 0, 0 };
+	int n = 0;
+	int c = -1;
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == '#')
+	{
+		ctx->linePos++;
+		n = get_channel(ctx);
+		if (n == 0)
+			return;
+
+		if (chan_mode(n) == CHAN_WRITE || chan_mode(n) == CHAN_APPEND)
+		{
+			ctx->error = ERR_NOT_INPUT;
+			ctx->error_line = ctx->line;
+			return;
+		}
+
+		if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != ',')
+		{
+			ctx->error = ERR_UNEXP;
+			ctx->error_line = ctx->line;
+			return;
+		}
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos + 1);
+	}
+
+	if (ctx->linePos == -1 || !ISALPHA(ctx->tokenized_line[ctx->linePos]))
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+	ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	if (n != 0)
+	{
+		FRESULT res = chan_getc(n, &c);
+		if (res != FR_OK)
+		{
+			file_error(ctx, res);
+			return;
+		}
+		var_add_update_float(ctx, (const unsigned char*)"ST", c == -1 || chan_eof(n) ? 64 : 0);
+	}
+	else
+		c = term_getchar();
+
+	if (c > 0)
+		value[0] = c;
+
+	if (name[length(name) - 1] == '$')
+		var_add_update_string(ctx, name, value, value[0] ? 1 : 0);
+	else if (value[0] != 0 && !ISDIGIT(value[0]))
+	{
+		ctx->error = ERR_FILE_DATA;
+		ctx->error_line = ctx->line;
+	}
+	else if (name[length(name) - 1] == '%')
+		var_add_update_int(ctx, name, value[0] ? value[0] - '0' : 0);
+	else
+		var_add_update_float(ctx, name, value[0] ? value[0] - '0' : 0);
+}
+
+// RECORD# n,record[,byte] goes to a record of an L channel, and to a byte
+// within it; both count from 1
+void exec_cmd_record(struct Context *ctx)
+{
+	int values[3];
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != '#')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return;
+	}
+	ctx->linePos++;
+
+	values[2] = 1;
+	if (exec_exprlist(ctx, values, 2, 3) < 0 || !check_channel(ctx, values[0]))
+		return;
+
+	if (chan_mode(values[0]) != CHAN_RECORD)
+	{
+		ctx->error = ERR_TYPE_MISMATCH;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	if (values[1] < 1 || values[2] < 1)
+	{
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	file_error(ctx, chan_record(values[0], values[1], values[2]));
+}
+
+// The memory after the file name of BLOAD and BSAVE: ,SCREEN for the page
+// being drawn to, or ,A for a DIM'd array. BLOAD makes an array that does
+// not exist yet big enough for loadsize bytes.
+bool get_block(struct Context *ctx, FSIZE_t loadsize, BYTE **data, UINT *size)
+{
+	unsigned char name[VAR_NAMESZ + 3];
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == ',')
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos + 1);
+	else
+		ctx->linePos = -1;
+
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] == TOKEN_SCREEN)
+	{
+		ctx->linePos++;
+		term_flush();
+		*data = vga_framebuffer;
+		*size = vga_pitch * vga_height;
+	}
+	else if (ctx->linePos != -1 && ISALPHA(ctx->tokenized_line[ctx->linePos]))
+	{
+		ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, name);
+
+		struct Array *a = array_find(ctx, name);
+		if (a == NULL && loadsize > 0 && (a = array_dim(ctx, name, (int)((loadsize - 1) / sizeof(float)), NULL)) == NULL)
+			return false;
+
+		if (a == NULL)
+		{
+			ctx->error = ERR_BAD_SUBSCRIPT;
+			ctx->error_line = ctx->line;
+			return false;
+		}
+
+		// a file array is a file already; it has no memory to move
+		if (a->file >= 0)
+		{
+			ctx->error = ERR_ILLEGAL_QUANTITY;
+			ctx->error_line = ctx->line;
+			return false;
+		}
+
+		*data = (BYTE*)a->location;
+		*size = a->size * sizeof(float);
+	}
+	else
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return false;
+	}
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != ':')
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return false;
+	}
+
+	return true;
+}
+
+// BLOAD and BSAVE hand the whole block to FatFs in one call. From the start
+// of the file every whole sector then goes straight between the block and
+// the card, a cluster at a time, and only the last part sector goes through
+// the file's own sector buffer.
+
+// BLOAD "file",SCREEN | BLOAD "file",A reads as much of the file as fits
+void exec_cmd_bload(struct Context *ctx)
+{
+	char fnbuffer[FILENAME_SZ + 1];
+	BYTE *data;
+	UINT size, got;
+	FIL fp;
+
+	if (!get_quoted(ctx, fnbuffer, FILENAME_SZ))
+		return;
+	to_uppercase((unsigned char *)fnbuffer);
+
+	FRESULT res = f_open(&fp, fnbuffer, FA_READ);
+	if (res != FR_OK)
+	{
+		file_error(ctx, res);
+		return;
+	}
+
+	if (get_block(ctx, f_size(&fp), &data, &size))
+	{
+		if (f_size(&fp) < size)
+			size = (UINT)f_size(&fp);
+
+		res = f_read(&fp, data, size, &got);
+		if (res == FR_OK && got != size)
+			res = FR_INT_ERR;
+	}
+
+	FRESULT closeRes = f_close(&fp);
+	if (ctx->error == ERR_NONE)
+		file_error(ctx, res != FR_OK ? res : closeRes);
+}
+
+// BSAVE "file",SCREEN | BSAVE "file",A replaces the file with the memory
+void exec_cmd_bsave(struct Context *ctx)
+{
+	char fnbuffer[FILENAME_SZ + 1];
+	BYTE *data;
+	UINT size, written;
+	FIL fp;
+
+	if (!get_quoted(ctx, fnbuffer, FILENAME_SZ))
+		return;
+	to_uppercase((unsigned char *)fnbuffer);
+
+	if (!get_block(ctx, 0, &data, &size))
+		return;
+
+	FRESULT res = f_open(&fp, fnbuffer, FA_WRITE | FA_CREATE_ALWAYS);
+	if (res != FR_OK)
+	{
+		file_error(ctx, res);
+		return;
+	}
+
+	// contiguous clusters let FatFs write runs of them back to back; no run
+	// that long is not an error, just slower
+	f_expand(&fp, size, 1);
+
+	res = f_write(&fp, data, size, &written);
+	if (res == FR_OK && written != size)
+		res = FR_DENIED;
+
+	FRESULT closeRes = f_close(&fp);
+	file_error(ctx, res != FR_OK ? res : closeRes);
+}
+
+void exec_cmd_then(struct Context *ctx)
+{
+	// skip this line (do nothing)
+	return;
+}
+
+// Parse "expr, expr, ..." into values. Returns how many were read, or -1 with
+// ctx->error set if there are fewer than min or a separator is missing.
+int exec_exprlist(struct Context *ctx, int *values, int min, int max)
+{
+	int count = 0;
+
+	while (count < max)
+	{
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] == 0 || ctx->tokenized_line[ctx->linePos] == ':')
+			break;
+
+		ctx->linePos = exec_expr(ctx);
+		if (ctx->error != ERR_NONE)
+			return -1;
+
+		values[count++] = (int)ctx->dstack[ctx->dsptr--];
+
+		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		if (ctx->linePos == -1 || ctx->tokenized_line[ctx->linePos] != ',')
+			break;
+		ctx->linePos++;
+	}
+
+	if (count < min || (ctx->linePos != -1 && ctx->tokenized_line[ctx->linePos] != 0 && ctx->tokenized_line[ctx->linePos] != ':'))
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return -1;
+	}
+
+	return count;
+}
+
+// Terminal scrolls are staged and only reach the framebuffer in term_flush(),
+// so every statement that draws to or reads the screen flushes them first;
+// otherwise what it draws would be moved up by the pending scroll later.
+void exec_cmd_plot(struct Context *ctx)
+{
+	int v[2];
+
+	term_flush();
+	if (exec_exprlist(ctx, v, 2, 2) < 0)
+		return;
+
+	vga_plotpixel(v[0], v[1]);
+}
+
+void exec_cmd_line(struct Context *ctx)
+{
+	int v[4];
+
+	term_flush();
+	if (exec_exprlist(ctx, v, 4, 4) < 0)
+		return;
+
+	vga_drawline(v[0], v[1], v[2], v[3]);
+}
+
+// BOX x1,y1,x2,y2[,fill]
+void exec_cmd_box(struct Context *ctx)
+{
+	int v[5];
+	int count = exec_exprlist(ctx, v, 4, 5);
+
+	term_flush();
+	if (count < 0)
+		return;
+
+	int x = v[0] < v[2] ? v[0] : v[2];
+	int y = v[1] < v[3] ? v[1] : v[3];
+	int w = abs(v[2] - v[0]);
+	int h = abs(v[3] - v[1]);
+
+	if (count == 5 && v[4])
+		vga_fillrect(x, y, w, h);
+	else
+		vga_drawrect(x, y, w, h);
+}
+
+// CIRCLE x,y,r[,fill]
+void exec_cmd_circle(struct Context *ctx)
+{
+	int v[4];
+	int count = exec_exprlist(ctx, v, 3, 4);
+
+	term_flush();
+	if (count < 0)
+		return;
+
+	if (count == 4 && v[3])
+		vga_fillcircle(v[0], v[1], v[2]);
+	else
+		vga_drawcircle(v[0], v[1], v[2]);
+}
+
+// COLOR fg[,bg] with palette numbers 0-255; 0-15 start out as the C64 colours
+void exec_cmd_color(struct Context *ctx)
+{
+	int v[2];
+	int count = exec_exprlist(ctx, v, 1, 2);
+
+	if (count < 0)
+		return;
+
+	vga_setforecolor(VGA_INDEXED(v[0] & 255));
+	if (count == 2)
+		vga_setbackcolor(VGA_INDEXED(v[1] & 255));
+}
+
+// PALETTE n,r,g,b sets an entry; PALETTE ROTATE first,last[,steps] shifts a
+// range of entries round, which at 8bpp animates without redrawing
+void exec_cmd_palette(struct Context *ctx)
+{
+	int v[4] = { 0, 0, 1, 0 };
+
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && strncmp((const char*)ctx->tokenized_line + ctx->linePos, "ROTATE", 6) == 0)
+	{
+		ctx->linePos += 6;
+		if (exec_exprlist(ctx, v, 2, 3) < 0)
+			return;
+
+		if (v[0] < 0 || v[0] > v[1] || v[1] > 255)
 		{
-			// next without for
-			ctx->error = ERR_NEXT_WO_FOR;
+			ctx->error = ERR_ILLEGAL_QUANTITY;
 			ctx->error_line = ctx->line;
+			return;
 		}
+
+		vga_rotatepalette(v[0], v[1], v[2]);
+		return;
 	}
-	else
+
+	if (exec_exprlist(ctx, v, 4, 4) < 0)
+		return;
+
+	if (v[0] < 0 || v[0] > 255)
+	{
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	RGBA colour = RGBA(v[1], v[2], v[3], 0xff);
+	vga_setpalette(v[0], 1, &colour);
+}
+
+// PAINT x,y fills the region around x,y that has the same colour
+void exec_cmd_paint(struct Context *ctx)
+{
+	int v[2];
+
+	term_flush();
+	if (exec_exprlist(ctx, v, 2, 2) < 0)
+		return;
+
+	if (!vga_floodfill(v[0], v[1]))
+	{
+		ctx->error = ERR_OUT_OF_MEMORY;
+		ctx->error_line = ctx->line;
+	}
+}
+
+// POLY x1,y1,x2,y2,x3,y3[,...] draws a filled polygon
+void exec_cmd_poly(struct Context *ctx)
+{
+	int v[VGA_MAXPOLY * 2];
+	int count = exec_exprlist(ctx, v, 6, VGA_MAXPOLY * 2);
+
+	term_flush();
+	if (count < 0)
+		return;
+
+	if (count & 1)
 	{
 		ctx->error = ERR_UNEXP;
 		ctx->error_line = ctx->line;
+		return;
 	}
 
-	free(tkn.token);
+	vga_fillpoly(v, count / 2);
 }
 
-void exec_cmd_print(struct Context *ctx)
+// SCREEN 1 draws to the visible page, SCREEN 2 to a hidden one shown by FLIP.
+// SCREEN SWAP is the same as FLIP. SCREEN w,h[,bpp] changes the display mode,
+// which clears the screen and drops all sprites. SCREEN TEST measures
+// framebuffer bandwidth under each memory type.
+void exec_cmd_screen(struct Context *ctx)
 {
-	bool eol = true;
-	bool quoteMode = false;
-	unsigned char val[200];
+	int v[3];
+	int count;
 
-	while (true)
+	term_flush();
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos != -1 && strncmp((const char*)ctx->tokenized_line + ctx->linePos, "SWAP", 4) == 0)
 	{
-		ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+		ctx->linePos += 4;
+		sprite_update();
+		vga_flip(1);
+		return;
+	}
 
-		if (ctx->linePos == -1 || ensure_token(ctx->tokenized_line[ctx->linePos], 1, ':'))
-			break;
+	if (ctx->linePos != -1 && strncmp((const char*)ctx->tokenized_line + ctx->linePos, "TEST", 4) == 0)
+	{
+		static const char *names[4] = { "device", "write combine", "write through", "write back" };
+		u32 fill[4], scroll[4];
 
-		ctx->linePos = get_symbol(ctx->tokenized_line, ctx->linePos, val);
+		ctx->linePos += 4;
+		sprite_reset();
+		for (int i = MEM_ATTR_DEVICE; i <= MEM_ATTR_WRITEBACK; i++)
+			vga_bandwidth(i, &fill[i], &scroll[i]);
+		term_layout();
 
-		// print string expression
-		if (val[length(val) - 1] == '$' || val[0] == '\"')
-		{
-			ctx->linePos = ctx->linePos - length(val);
-			int len = 0;
-			ctx->linePos = exec_strexpr(ctx, &len);
-			if (ctx->error == ERR_NONE)
-			{
-				term_printf("%s", ctx->strPtr);
-				free(ctx->strPtr);
-			}	
-			else
-				break;
-		}
-		else
-		{
-			// print numeric expression
-			ctx->linePos = ctx->linePos - length(val);
-			ctx->linePos = exec_expr(ctx);
-			if (ctx->error == ERR_NONE)
-				term_printf("%g", (double)ctx->dstack[ctx->dsptr--]);
-			else
-				break;
-		}
+		for (int i = MEM_ATTR_DEVICE; i <= MEM_ATTR_WRITEBACK; i++)
+			term_printf("%-14s fill %5u MB/s  scroll %5u MB/s\n", names[i], fill[i], scroll[i]);
+		return;
+	}
 
-		if (ctx->tokenized_line[ctx->linePos] == ';')
+	count = exec_exprlist(ctx, v, 1, 3);
+	if (count < 0)
+		return;
+
+	if (count > 1)
+	{
+		if (count == 2)
+			v[2] = vga_bpp;
+
+		if (v[0] < VGA_MINWIDTH || v[0] > VGA_MAXWIDTH || v[1] < VGA_MINHEIGHT || v[1] > VGA_MAXHEIGHT ||
+			(v[2] != 8 && v[2] != 16 && v[2] != 24 && v[2] != 32))
 		{
-			ctx->linePos++;
-			eol = false;
+			ctx->error = ERR_ILLEGAL_QUANTITY;
+			ctx->error_line = ctx->line;
+			return;
 		}
 
-		if (ctx->tokenized_line[ctx->linePos] == ',')
+		// sprites and their saved backgrounds are in the old pixel format
+		sprite_reset();
+		int ok = vga_setmode(v[0], v[1], v[2]);
+		term_layout();
+
+		// the firmware refused the mode and the old one is back
+		if (!ok)
 		{
-			ctx->linePos++;
-			term_printf("     ");
+			ctx->error = ERR_ILLEGAL_QUANTITY;
+			ctx->error_line = ctx->line;
 		}
+		return;
 	}
 
-	if (eol) term_putchar('\n');
-}
-
-void exec_cmd_rem(struct Context *ctx)
-{
-	// skip this line (do nothing)
-	ctx->linePos = -1;
-	return;
-}
-
-void exec_cmd_return(struct Context *ctx)
-{
-	if (ctx->csptr == 0)
+	u32 pages = vga_pagecount;
+	if ((v[0] != 1 && v[0] != 2) || !vga_setpages(v[0]))
 	{
-		ctx->error = ERR_RTRN_WO_GSB;
+		ctx->error = ERR_ILLEGAL_QUANTITY;
 		ctx->error_line = ctx->line;
 		return;
 	}
 
-	// release current line resource
-	free(ctx->tokenized_line);
-	
-	// Get previous line pos and line number from stack
-	ctx->linePos = ctx->cstack[ctx->csptr--];
-	ctx->line = ll_find(ctx->cstack[ctx->csptr])->linenum;
-	ctx->original_line = ll_find(ctx->cstack[ctx->csptr--])->data;
-	
-	// retokenize the line
-	unsigned char* tokenized_line = (unsigned char*)malloc(sizeof(unsigned char)*160);
-	tokenize(ctx, ctx->original_line, tokenized_line);
-
-	ctx->tokenized_line = tokenized_line;
-	ctx->jmpline = ctx->line;
+	// the back page starts as a copy of the visible one, sprites included
+	if (pages == 1 && v[0] == 2)
+		sprite_clonepage(vga_visiblepage, vga_visiblepage ^ 1);
 }
 
-void exec_cmd_run(struct Context *ctx)
+// FLIP [wait]: show the page drawn since the last flip, waiting for vsync unless wait is 0
+void exec_cmd_flip(struct Context *ctx)
 {
-	exec_program(ctx);
-	ctx->linePos = -1;
-	return;
+	int v[1] = { 1 };
+
+	term_flush();
+	if (exec_exprlist(ctx, v, 0, 1) < 0)
+		return;
+
+	sprite_update();
+	vga_flip(v[0] != 0);
 }
 
-void exec_cmd_save(struct Context *ctx)
+// SPRITE DEF n,x,y,w,h captures a sprite from the screen, background colour
+// transparent. SPRITE MOVE n,x,y shows it at x,y and SPRITE OFF n hides it.
+void exec_cmd_sprite(struct Context *ctx)
 {
-	FIL fp;
-	FRESULT res;
-	int bufferCtr = 0;
-	char fnbuffer[15] = {0};
+	int v[5];
+	int ok = 0;
+	const char *p;
 
-	// skip spaces
-	ctx->linePos = ignore_space(ctx->tokenized_line,ctx->linePos);
-	
-	// expect quote
-	if(ctx->tokenized_line[ctx->linePos] != '\"')
+	term_flush();
+	ctx->linePos = ignore_space(ctx->tokenized_line, ctx->linePos);
+	if (ctx->linePos == -1)
 	{
 		ctx->error = ERR_UNEXP;
 		ctx->error_line = ctx->line;
 		return;
 	}
-	ctx->linePos++;
-	while(ctx->tokenized_line[ctx->linePos] != 0 && ctx->tokenized_line[ctx->linePos] != '\"')
+
+	p = (const char*)ctx->tokenized_line + ctx->linePos;
+	if (strncmp(p, "DEF", 3) == 0)
 	{
-		fnbuffer[bufferCtr++] = ctx->tokenized_line[ctx->linePos++];
-	
-		if(bufferCtr == 15)
-			ctx->tokenized_line[ctx->linePos] = '\"';
+		ctx->linePos += 3;
+		if (exec_exprlist(ctx, v, 5, 5) < 0)
+			return;
+		ok = sprite_define(v[0], v[1], v[2], v[3], v[4]);
 	}
-
-	// expect closing quote
-	if(ctx->tokenized_line[ctx->linePos] != '\"')
+	else if (strncmp(p, "MOVE", 4) == 0)
+	{
+		ctx->linePos += 4;
+		if (exec_exprlist(ctx, v, 3, 3) < 0)
+			return;
+		ok = sprite_move(v[0], v[1], v[2]);
+	}
+	else if (strncmp(p, "OFF", 3) == 0)
+	{
+		ctx->linePos += 3;
+		if (exec_exprlist(ctx, v, 1, 1) < 0)
+			return;
+		ok = sprite_off(v[0]);
+	}
+	else
 	{
 		ctx->error = ERR_UNEXP;
 		ctx->error_line = ctx->line;
 		return;
 	}
-	
-	fnbuffer[bufferCtr++] = '.';
-	fnbuffer[bufferCtr++] = 'B';
-	fnbuffer[bufferCtr++] = 'A';
-	fnbuffer[bufferCtr++] = 'S';
-	fnbuffer[bufferCtr] = 0;
-	
-	to_uppercase((unsigned char *)fnbuffer);
-	
-	bufferCtr = 0;
 
-	//snprintf(fnbuffer, sizeof(fnbuffer), "%s.BAS", filename);
-	
-	res = f_open(&fp, fnbuffer, FA_WRITE | FA_CREATE_NEW);
-	
-	if (res == FR_OK)
+	if (!ok)
 	{
-		term_printf("Saving %s", fnbuffer);
-		
-		ll_sort();
-		struct node *ptr = ll_gethead();
-
-		//start from the beginning
-		while (ptr != NULL) 
-		{
-			char lnbuff[160] = { 0 };
-			snprintf(lnbuff, sizeof(lnbuff), "%d %s\n", ptr->linenum, ptr->data);
-			f_puts(lnbuff, &fp);
-			ptr = ptr->next;
-		}
-		
-		f_close(&fp);
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
 	}
-	else
-		term_printf("?File Save Error #%d", res);
 }
 
-void exec_cmd_then(struct Context *ctx)
+// FONT n[,scale] picks the 8x8 (0) or 8x16 (1) font, scaled up to 3 times,
+// and clears the screen with as many rows and columns as now fit
+void exec_cmd_font(struct Context *ctx)
 {
-	// skip this line (do nothing)
-	return;
+	int v[2] = { 0, 1 };
+
+	if (exec_exprlist(ctx, v, 1, 2) < 0)
+		return;
+
+	if (v[0] < 0 || v[1] < 0 || !vga_setfont(v[0], v[1]))
+	{
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+		ctx->error_line = ctx->line;
+		return;
+	}
+
+	term_layout();
 }
 
 void var_clear_all(struct Context *ctx)
@@ -1393,6 +2949,7 @@ void var_clear_all(struct Context *ctx)
 	}
 
 	ctx->var_count = 0;
+	array_clear_all(ctx);
 }
 
 void var_add_update_int(struct Context *ctx, const unsigned char *key, int value)
@@ -1478,6 +3035,180 @@ void var_add_update_string(struct Context *ctx, const unsigned char *key, unsign
 
 }
 
+struct Array *array_find(struct Context *ctx, const unsigned char *name)
+{
+	for (int j = 0; j < ctx->array_count; j++)
+		if (compare(ctx->arrays[j].name, name))
+			return &ctx->arrays[j];
+
+	return NULL;
+}
+
+// an array of size + 1 elements, on the heap or in file; NULL with ctx->error set
+struct Array *array_dim(struct Context *ctx, const unsigned char *name, int size, const char *file)
+{
+	struct Array *a;
+
+	if (name[length(name) - 1] == '$')
+		ctx->error = ERR_TYPE_MISMATCH;
+	else if (array_find(ctx, name) != NULL)
+		ctx->error = ERR_REDIM;
+	else if (size < 0 || size >= 0x3fffffff)
+		ctx->error = ERR_ILLEGAL_QUANTITY;
+	else if (ctx->array_count == ARRAY_MAX)
+		ctx->error = ERR_OUT_OF_MEMORY;
+
+	if (ctx->error != ERR_NONE)
+	{
+		ctx->error_line = ctx->line;
+		return NULL;
+	}
+
+	a = &ctx->arrays[ctx->array_count];
+	a->size = size + 1;
+	a->location = NULL;
+	a->file = -1;
+
+	// float and int elements are both 4 bytes
+	if (file != NULL)
+	{
+		FRESULT res = farray_open(file, a->size, sizeof(float), &a->file);
+		if (res != FR_OK)
+		{
+			file_error(ctx, res);
+			return NULL;
+		}
+	}
+	else if ((a->location = calloc(a->size, sizeof(float))) == NULL)
+	{
+		ctx->error = ERR_OUT_OF_MEMORY;
+		ctx->error_line = ctx->line;
+		return NULL;
+	}
+
+	strcpy((char *)a->name, (const char *)name);
+	ctx->array_count++;
+	return a;
+}
+
+// the element's array, which is made with ARRAY_DEFAULT + 1 elements the
+// first time an array is used without DIM
+static struct Array *array_element(struct Context *ctx, const unsigned char *name, int index)
+{
+	struct Array *a = array_find(ctx, name);
+
+	if (a == NULL && (a = array_dim(ctx, name, ARRAY_DEFAULT, NULL)) == NULL)
+		return NULL;
+
+	if (index < 0 || index >= a->size)
+	{
+		ctx->error = ERR_BAD_SUBSCRIPT;
+		ctx->error_line = ctx->line;
+		return NULL;
+	}
+
+	return a;
+}
+
+bool array_get(struct Context *ctx, const unsigned char *name, int index, double *value)
+{
+	struct Array *a = array_element(ctx, name, index);
+	union { float f; int i; } element;
+
+	if (a == NULL)
+		return false;
+
+	if (a->file >= 0)
+	{
+		FRESULT res = farray_get(a->file, index, &element);
+		if (res != FR_OK)
+		{
+			file_error(ctx, res);
+			return false;
+		}
+	}
+	else
+		memcpy(&element, (char*)a->location + (index * sizeof(element)), sizeof(element));
+
+	*value = name[length(name) - 1] == '%' ? (double)element.i : (double)element.f;
+	return true;
+}
+
+bool array_set(struct Context *ctx, const unsigned char *name, int index, double value)
+{
+	struct Array *a = array_element(ctx, name, index);
+	union { float f; int i; } element;
+
+	if (a == NULL)
+		return false;
+
+	if (name[length(name) - 1] == '%')
+		element.i = (int)value;
+	else
+		element.f = value;
+
+	if (a->file >= 0)
+	{
+		FRESULT res = farray_put(a->file, index, &element);
+		if (res != FR_OK)
+		{
+			file_error(ctx, res);
+			return false;
+		}
+	}
+	else
+		memcpy((char*)a->location + (index * sizeof(element)), &element, sizeof(element));
+
+	return true;
+}
+
+void array_clear_all(struct Context *ctx)
+{
+	for (int j = 0; j < ctx->array_count; j++)
+	{
+		if (ctx->arrays[j].file >= 0)
+			farray_close(ctx->arrays[j].file);
+		free(ctx->arrays[j].location);
+	}
+
+	ctx->array_count = 0;
+}
+
+// The subscript of an array: the expression in the brackets at lpos. Returns
+// the position after the closing bracket.
+int exec_subscript(struct Context *ctx, int lpos, int *index)
+{
+	int close = lpos;
+	int depth = 0;
+
+	// find the matching bracket so exec_expr stops at it
+	for (; ctx->tokenized_line[close] != 0; close++)
+	{
+		if (ctx->tokenized_line[close] == '(')
+			depth++;
+		else if (ctx->tokenized_line[close] == ')' && --depth == 0)
+			break;
+	}
+
+	if (ctx->tokenized_line[close] == 0)
+	{
+		ctx->error = ERR_UNEXP;
+		ctx->error_line = ctx->line;
+		return close;
+	}
+
+	unsigned char saved = ctx->tokenized_line[close + 1];
+	ctx->tokenized_line[close + 1] = 0;
+	ctx->linePos = lpos;
+	exec_expr(ctx);
+	ctx->tokenized_line[close + 1] = saved;
+
+	if (ctx->error == ERR_NONE)
+		*index = (int)ctx->dstack[ctx->dsptr--];
+
+	return close + 1;
+}
+
 // sbparse
 
 int get_symbol(const unsigned char *s, int i, unsigned char *t)
@@ -1900,6 +3631,22 @@ void tokenize(struct Context* ctx, const unsigned char* input, unsigned char *ou
 					if (compare(tempStack, ctx->cmds[j].name))
 					{
 						output[o++] = ctx->cmds[j].token;
+
+						// PRINT# and INPUT# are keywords of their own
+						if (input[i] == '#')
+						{
+							strcat((char *)tempStack, "#");
+							for (int k = 0; k < CMD_COUNT; k++)
+							{
+								if (compare(tempStack, ctx->cmds[k].name))
+								{
+									output[o - 1] = ctx->cmds[k].token;
+									i++;
+									break;
+								}
+							}
+						}
+
 						tempStackPtr = 0;
 						break;
 					}
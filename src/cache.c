@@ -133,6 +133,68 @@ void map_4k_page(int logical, int physical) {
 #endif
 }
 
+#define CACHE_LINE 64
+
+void clean_dcache_range(void *start, unsigned length)
+{
+  unsigned addr = (unsigned) start & ~(CACHE_LINE - 1);
+  unsigned end = (unsigned) start + length;
+
+  for (; addr < end; addr += CACHE_LINE)
+    asm volatile ("mcr p15, 0, %0, c7, c10, 1" : : "r" (addr) : "memory");   // DCCMVAC
+#if defined(RPI2) || defined(RPI3)
+  asm volatile ("dsb" ::: "memory");
+#endif
+}
+
+void clean_invalidate_dcache_range(void *start, unsigned length)
+{
+  unsigned addr = (unsigned) start & ~(CACHE_LINE - 1);
+  unsigned end = (unsigned) start + length;
+
+  for (; addr < end; addr += CACHE_LINE)
+    _clean_invalidate_dcache_mva((void *) addr);
+#if defined(RPI2) || defined(RPI3)
+  asm volatile ("dsb" ::: "memory");
+#endif
+}
+
+// Section descriptors for each MEM_ATTR_ value, using the same encodings as
+// enable_MMU_and_IDCaches() below
+static const unsigned section_attr[4] =
+{
+  0x10C16,                                              // MEM_ATTR_DEVICE: shared device, never execute
+  0x01C02,                                              // MEM_ATTR_WRITECOMBINE: normal, outer and inner non-cacheable
+  0x10C0A,                                              // MEM_ATTR_WRITETHROUGH: write through, no write allocate, shareable
+  0x11C0E                                               // MEM_ATTR_WRITEBACK: write back, write allocate, shareable
+};
+
+// Change the memory type of the 1MB sections covering base..base+size. Call
+// after enable_MMU_and_IDCaches(), which rebuilds the whole table.
+void set_section_attr(unsigned base, unsigned size, int attr)
+{
+  unsigned first = base >> 20;
+  unsigned last = (base + size - 1) >> 20;
+  unsigned i;
+
+  if (size == 0 || attr < MEM_ATTR_DEVICE || attr > MEM_ATTR_WRITEBACK || last >= uncached_threshold)
+    return;
+
+  // anything still dirty has to reach memory before the mapping stops caching it
+  clean_invalidate_dcache_range((void *) (first << 20), (last - first + 1) << 20);
+
+  for (i = first; i <= last; i++)
+  {
+    PageTable[i] = i << 20 | section_attr[attr];
+    _invalidate_dtlb_mva((void *) (i << 20));
+  }
+
+#if defined(RPI2) || defined(RPI3)
+  asm volatile ("dsb" ::: "memory");
+  asm volatile ("isb" ::: "memory");
+#endif
+}
+
 void enable_MMU_and_IDCaches(void)
 {
 
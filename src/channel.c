@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+#include "channel.h"
+
+struct channel
+{
+	int open;
+	int mode;
+	FIL fil;
+	UINT reclen;
+	FSIZE_t recend;			// end of the current record
+	BYTE *buf;
+	UINT bufsize;			// a whole number of sectors
+	FSIZE_t bufpos;			// file offset of buf[0]
+	UINT buflen;			// bytes read into buf, or waiting in it to be written
+	UINT bufptr;			// next byte to read from buf
+	int dirty;				// buf holds writes rather than reads
+	DWORD *linkmap;			// 0 when seeks follow the FAT chain
+	DWORD mapsize;			// entries in linkmap
+	FSIZE_t mapped;			// file size when the map was built
+};
+
+static struct channel channels[CHAN_MAX];
+static const BYTE chan_zeros[CHAN_SECTOR];
+
+static struct channel *chan_get(int n)
+{
+	if (n < 1 || n > CHAN_MAX || !channels[n - 1].open)
+		return 0;
+	return &channels[n - 1];
+}
+
+static FSIZE_t chan_pos(struct channel *c)
+{
+	return c->bufpos + (c->dirty ? c->buflen : c->bufptr);
+}
+
+// Build the link map of the whole file. It is only handed to FatFs for the
+// length of a seek: reads and writes follow the chain from wherever the seek
+// left them, and writes past the end can add clusters the map doesn't have.
+static void chan_mapfile(struct channel *c)
+{
+	FRESULT res;
+
+	c->fil.cltbl = c->linkmap;
+	c->linkmap[0] = c->mapsize;
+	res = f_lseek(&c->fil, CREATE_LINKMAP);
+
+	// more fragments than entries; FatFs has put the number needed in linkmap[0]
+	if (res == FR_NOT_ENOUGH_CORE)
+	{
+		DWORD need = c->linkmap[0];
+		DWORD *map = (DWORD*)realloc(c->linkmap, need * sizeof(DWORD));
+
+		if (map)
+		{
+			c->linkmap = map;
+			c->mapsize = need;
+			map[0] = need;
+			c->fil.cltbl = map;
+			res = f_lseek(&c->fil, CREATE_LINKMAP);
+		}
+	}
+
+	c->fil.cltbl = 0;
+
+	if (res == FR_OK)
+		c->mapped = f_size(&c->fil);
+	else
+	{
+		// seeks still work without it, they just walk the chain
+		free(c->linkmap);
+		c->linkmap = 0;
+	}
+}
+
+static FRESULT chan_lseek(struct channel *c, FSIZE_t pos)
+{
+	FRESULT res;
+
+	// rebuilt each time the file has doubled, so a file that keeps growing
+	// is not walked end to end for every seek
+	if (c->linkmap && f_size(&c->fil) > c->mapped * 2)
+		chan_mapfile(c);
+
+	if (c->linkmap && c->mapped && pos <= c->mapped)
+	{
+		c->fil.cltbl = c->linkmap;
+		res = f_lseek(&c->fil, pos);
+		c->fil.cltbl = 0;
+		return res;
+	}
+
+	return f_lseek(&c->fil, pos);
+}
+
+// write buf out at bufpos, filling any gap past the end of the file with zeros
+static FRESULT chan_writeout(struct channel *c)
+{
+	FSIZE_t size = f_size(&c->fil);
+	FSIZE_t start = c->bufpos < size ? c->bufpos : size;
+	FRESULT res = FR_OK;
+	UINT done;
+
+	if (f_tell(&c->fil) != start)
+		res = chan_lseek(c, start);
+
+	while (res == FR_OK && f_tell(&c->fil) < c->bufpos)
+	{
+		UINT gap = CHAN_SECTOR - (UINT)(f_tell(&c->fil) % CHAN_SECTOR);
+		if (gap > c->bufpos - f_tell(&c->fil))
+			gap = (UINT)(c->bufpos - f_tell(&c->fil));
+
+		res = f_write(&c->fil, chan_zeros, gap, &done);
+		if (res == FR_OK && done != gap)
+			res = FR_DENIED;		// the disk is full
+	}
+
+	if (res == FR_OK)
+		res = f_write(&c->fil, c->buf, c->buflen, &done);
+	if (res == FR_OK && done != c->buflen)
+		res = FR_DENIED;
+
+	return res;
+}
+
+// write out or drop whatever is in buf, leaving it empty at the current position
+static FRESULT chan_flushbuf(struct channel *c)
+{
+	FSIZE_t pos = chan_pos(c);
+	FRESULT res = FR_OK;
+
+	if (c->dirty && c->buflen)
+		res = chan_writeout(c);
+
+	c->bufpos = pos;
+	c->buflen = c->bufptr = 0;
+	c->dirty = 0;
+	return res;
+}
+
+static FRESULT chan_fill(struct channel *c)
+{
+	FSIZE_t pos = chan_pos(c);
+	FRESULT res = chan_flushbuf(c);
+
+	// from a sector boundary, so f_read puts whole sectors straight into buf
+	FSIZE_t start = pos - pos % CHAN_SECTOR;
+
+	if (res != FR_OK || start >= f_size(&c->fil))
+		return res;
+
+	if (f_tell(&c->fil) != start)
+		res = chan_lseek(c, start);
+	if (res == FR_OK)
+		res = f_read(&c->fil, c->buf, c->bufsize, &c->buflen);
+
+	if (res == FR_OK)
+	{
+		c->bufpos = start;
+		c->bufptr = (UINT)(pos - start);
+	}
+	else
+		c->buflen = 0;
+
+	return res;
+}
+
+static FRESULT chan_seek(struct channel *c, FSIZE_t pos)
+{
+	FRESULT res;
+
+	// somewhere in what has been read already
+	if (!c->dirty && pos >= c->bufpos && pos < c->bufpos + c->buflen)
+	{
+		c->bufptr = (UINT)(pos - c->bufpos);
+		return FR_OK;
+	}
+
+	if (pos == chan_pos(c))
+		return FR_OK;
+
+	// the file itself is only moved when buf is next filled or written out
+	res = chan_flushbuf(c);
+	c->bufpos = pos;
+	return res;
+}
+
+// add len bytes of data, or zeros without data, to buf
+static FRESULT chan_put(struct channel *c, const BYTE *data, UINT len)
+{
+	FRESULT res = FR_OK;
+
+	if (!c->dirty)
+	{
+		res = chan_flushbuf(c);
+		c->dirty = 1;
+	}
+
+	while (res == FR_OK && len)
+	{
+		// the first write out ends on a sector boundary and later ones are
+		// whole sectors
+		UINT room = c->bufsize - (UINT)(c->bufpos % CHAN_SECTOR) - c->buflen;
+
+		if (room == 0)
+		{
+			res = chan_flushbuf(c);
+			c->dirty = 1;
+			continue;
+		}
+
+		if (room > len)
+			room = len;
+
+		if (data)
+		{
+			memcpy(c->buf + c->buflen, data, room);
+			data += room;
+		}
+		else
+			memset(c->buf + c->buflen, 0, room);
+
+		c->buflen += room;
+		len -= room;
+	}
+
+	return res;
+}
+
+FRESULT chan_open(int n, const char *name, int mode, UINT reclen)
+{
+	static const BYTE access[] = {
+		FA_READ | FA_OPEN_EXISTING,
+		FA_WRITE | FA_CREATE_ALWAYS,
+		FA_WRITE | FA_OPEN_APPEND,
+		FA_READ | FA_WRITE | FA_OPEN_ALWAYS
+	};
+	struct channel *c;
+	FRESULT res;
+
+	if (n < 1 || n > CHAN_MAX || mode < CHAN_READ || mode > CHAN_RECORD)
+		return FR_INVALID_PARAMETER;
+	if (mode == CHAN_RECORD && (reclen < 1 || reclen > CHAN_RECMAX))
+		return FR_INVALID_PARAMETER;
+
+	c = &channels[n - 1];
+	if (c->open)
+		return FR_LOCKED;
+
+	memset(c, 0, sizeof(*c));
+
+	// a record channel only needs room for one record across a sector boundary
+	if (mode == CHAN_RECORD)
+	{
+		c->bufsize = ((reclen + CHAN_SECTOR - 1) / CHAN_SECTOR + 1) * CHAN_SECTOR;
+		c->mapsize = CHAN_LINKMAP;
+		c->linkmap = (DWORD*)malloc(CHAN_LINKMAP * sizeof(DWORD));
+	}
+	else
+		c->bufsize = CHAN_SEQSECTORS * CHAN_SECTOR;
+
+	c->buf = (BYTE*)malloc(c->bufsize);
+	if (!c->buf)
+	{
+		free(c->linkmap);
+		c->linkmap = 0;
+		return FR_NOT_ENOUGH_CORE;
+	}
+
+	res = f_open(&c->fil, name, access[mode]);
+	if (res != FR_OK)
+	{
+		free(c->buf);
+		free(c->linkmap);
+		memset(c, 0, sizeof(*c));
+		return res;
+	}
+
+	c->open = 1;
+	c->mode = mode;
+	c->reclen = reclen;
+	c->recend = reclen;
+	c->bufpos = f_tell(&c->fil);	// the end of the file when appending
+	return FR_OK;
+}
+
+FRESULT chan_close(int n)
+{
+	struct channel *c = chan_get(n);
+	FRESULT res, closeRes;
+
+	if (!c)
+		return FR_INVALID_OBJECT;
+
+	res = chan_flushbuf(c);
+	closeRes = f_close(&c->fil);
+	if (res == FR_OK)
+		res = closeRes;
+
+	free(c->buf);
+	free(c->linkmap);
+	memset(c, 0, sizeof(*c));
+	return res;
+}
+
+void chan_closeall()
+{
+	for (int n = 1; n <= CHAN_MAX; n++)
+		if (chan_get(n))
+			chan_close(n);
+}
+
+FRESULT chan_sync()
+{
+	FRESULT res = FR_OK;
+
+	for (int n = 1; n <= CHAN_MAX; n++)
+	{
+		struct channel *c = chan_get(n);
+		if (!c)
+			continue;
+
+		FRESULT r = chan_flushbuf(c);
+		if (r == FR_OK)
+			r = f_sync(&c->fil);
+		if (res == FR_OK)
+			res = r;
+	}
+
+	return res;
+}
+
+int chan_isopen(int n)
+{
+	return chan_get(n) != 0;
+}
+
+int chan_mode(int n)
+{
+	struct channel *c = chan_get(n);
+	return c ? c->mode : -1;
+}
+
+int chan_eof(int n)
+{
+	struct channel *c = chan_get(n);
+	FSIZE_t pos;
+
+	if (!c)
+		return 1;
+
+	pos = chan_pos(c);
+	if (c->mode == CHAN_RECORD)
+	{
+		if (pos >= c->recend)
+			return 1;
+		if (!c->dirty && c->bufptr < c->buflen)
+			return c->buf[c->bufptr] == 0;
+	}
+
+	return pos >= f_size(&c->fil);
+}
+
+FRESULT chan_getc(int n, int *ch)
+{
+	struct channel *c = chan_get(n);
+	FRESULT res;
+
+	*ch = -1;
+	if (!c)
+		return FR_INVALID_OBJECT;
+	if (c->mode == CHAN_WRITE || c->mode == CHAN_APPEND)
+		return FR_DENIED;
+	if (c->mode == CHAN_RECORD && chan_pos(c) >= c->recend)
+		return FR_OK;
+
+	if (c->dirty || c->bufptr == c->buflen)
+	{
+		res = chan_fill(c);
+		if (res != FR_OK || c->bufptr == c->buflen)
+			return res;
+	}
+
+	// the zeros after the data of a record are not read
+	if (c->mode == CHAN_RECORD && c->buf[c->bufptr] == 0)
+		return FR_OK;
+
+	*ch = c->buf[c->bufptr++];
+	return FR_OK;
+}
+
+FRESULT chan_write(int n, const void *data, UINT len)
+{
+	struct channel *c = chan_get(n);
+
+	if (!c)
+		return FR_INVALID_OBJECT;
+	if (c->mode == CHAN_READ)
+		return FR_DENIED;
+
+	if (c->mode == CHAN_RECORD)
+	{
+		FSIZE_t pos = chan_pos(c);
+		if (pos >= c->recend)
+			return FR_OK;
+		if (len > c->recend - pos)
+			len = (UINT)(c->recend - pos);
+	}
+
+	return chan_put(c, (const BYTE*)data, len);
+}
+
+FRESULT chan_record(int n, DWORD rec, UINT byte)
+{
+	struct channel *c = chan_get(n);
+	FSIZE_t start;
+
+	if (!c)
+		return FR_INVALID_OBJECT;
+	if (c->mode != CHAN_RECORD)
+		return FR_DENIED;
+	if (rec < 1 || byte < 1 || byte > c->reclen || rec > ((FSIZE_t)0 - 1) / c->reclen)
+		return FR_INVALID_PARAMETER;
+
+	start = (FSIZE_t)(rec - 1) * c->reclen;
+	c->recend = start + c->reclen;
+	return chan_seek(c, start + byte - 1);
+}
+
+FRESULT chan_endrecord(int n)
+{
+	struct channel *c = chan_get(n);
+	FSIZE_t pos;
+	FRESULT res = FR_OK;
+
+	if (!c)
+		return FR_INVALID_OBJECT;
+	if (c->mode != CHAN_RECORD)
+		return FR_DENIED;
+
+	pos = chan_pos(c);
+	if (pos < c->recend)
+		res = chan_put(c, 0, (UINT)(c->recend - pos));
+
+	c->recend += c->reclen;
+	return res;
+}
@@ -8,35 +8,330 @@
 /*-----------------------------------------------------------------------*/
 
 #include "diskio.h"		/* FatFs lower layer API */
+#include <string.h>
 
 /* Definitions of physical drive number for each drive */
 #define DEV_MMC		0	/* Example: Map MMC/SD card to physical drive 0 */
 
 //static struct emmc_block_dev *emmc_dev;
 static CEMMCDevice* pEMMC;
+static BYTE* disk_image;
+static DWORD disk_imagesectors;
 
 #define SD_BLOCK_SIZE		512
+#define SD_MAX_BLOCKS		0xffff	/* most blocks the controller moves in one command */
 
 void disk_setEMM(CEMMCDevice* pEMMCDevice)
 {
 	pEMMC = pEMMCDevice;
 }
 
+void disk_getlatency(unsigned command, u32 *buckets)
+{
+	pEMMC->GetLatency(command, buckets);
+}
+
+/* Serve the drive from a sector image in memory rather than the card */
+void disk_setimage(BYTE *image, DWORD sectors)
+{
+	disk_image = image;
+	disk_imagesectors = sectors;
+}
+
 int sd_card_init(struct block_device **dev)
 {
 	return 0;
 }
 
+// the device returns -1 on failure, which is reported as no bytes moved
 size_t sd_read(uint8_t *buf, size_t buf_size, uint32_t block_no)
 {
 //	g_pLogger->Write("", LogNotice, "sd_read %d", block_no);
 
-	return pEMMC->DoRead(buf, buf_size, block_no);
+	int result = pEMMC->DoRead(buf, buf_size, block_no);
+	return result < 0 ? 0 : result;
 }
 
 size_t sd_write(uint8_t *buf, size_t buf_size, uint32_t block_no)
 {
-	return pEMMC->DoWrite(buf, buf_size, block_no);
+	int result = pEMMC->DoWrite(buf, buf_size, block_no);
+	return result < 0 ? 0 : result;
+}
+
+/* Whole runs go to the card as one READ/WRITE_MULTIPLE_BLOCK */
+static DRESULT dev_read(BYTE *buff, DWORD sector, UINT count)
+{
+	if (disk_image)
+	{
+		if (sector + count > disk_imagesectors || sector + count < sector)
+			return RES_ERROR;
+		memcpy(buff, disk_image + (sector * SD_BLOCK_SIZE), count * SD_BLOCK_SIZE);
+		return RES_OK;
+	}
+
+	while (count > 0)
+	{
+		UINT blocks = count < SD_MAX_BLOCKS ? count : SD_MAX_BLOCKS;
+		size_t buf_size = blocks * SD_BLOCK_SIZE;
+
+		if (sd_read(buff, buf_size, sector) != buf_size)
+		{
+			return RES_ERROR;
+		}
+		buff += buf_size;
+		sector += blocks;
+		count -= blocks;
+	}
+	return RES_OK;
+}
+
+static DRESULT dev_write(const BYTE *buff, DWORD sector, UINT count)
+{
+	if (disk_image)
+	{
+		if (sector + count > disk_imagesectors || sector + count < sector)
+			return RES_ERROR;
+		memcpy(disk_image + (sector * SD_BLOCK_SIZE), buff, count * SD_BLOCK_SIZE);
+		return RES_OK;
+	}
+
+	while (count > 0)
+	{
+		UINT blocks = count < SD_MAX_BLOCKS ? count : SD_MAX_BLOCKS;
+		size_t buf_size = blocks * SD_BLOCK_SIZE;
+
+		if (sd_write((uint8_t *)buff, buf_size, sector) != buf_size)
+		{
+			return RES_ERROR;
+		}
+		buff += buf_size;
+		sector += blocks;
+		count -= blocks;
+	}
+	return RES_OK;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+/* FatFs keeps only one window sector per volume and per file, so FAT and */
+/* directory sectors are read again and again. The most recently used    */
+/* sectors are kept here and written back when they are evicted or on    */
+/* CTRL_SYNC. A read starting where the last one ended also fetches the   */
+/* next DISK_READAHEAD sectors. Transfers of DISK_STAGE_SECTORS or more   */
+/* go straight to the card.                                              */
+
+typedef struct {
+	DWORD	sector;
+	DWORD	lastuse;
+	BYTE	valid;
+	BYTE	dirty;
+} CACHE_LINE;
+
+static CACHE_LINE cache_lines[DISK_CACHE_SECTORS];
+static BYTE cache_data[DISK_CACHE_SECTORS][SD_BLOCK_SIZE] __attribute__((aligned(4)));
+static BYTE cache_stage[DISK_STAGE_SECTORS * SD_BLOCK_SIZE] __attribute__((aligned(4)));
+static DWORD cache_clock;
+static DWORD cache_next;		/* sector after the last read */
+static DISK_CACHESTATS cache_stats;
+
+static int cache_find(DWORD sector)
+{
+	for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+		if (cache_lines[i].valid && cache_lines[i].sector == sector)
+			return i;
+	return -1;
+}
+
+/* A free line, or the least recently used one once it is written back */
+static int cache_victim(void)
+{
+	int victim = 0;
+
+	for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+	{
+		if (!cache_lines[i].valid)
+			return i;
+		if (cache_lines[i].lastuse < cache_lines[victim].lastuse)
+			victim = i;
+	}
+
+	if (cache_lines[victim].dirty)
+	{
+		if (dev_write(cache_data[victim], cache_lines[victim].sector, 1) != RES_OK)
+			return -1;
+		cache_lines[victim].dirty = 0;
+		cache_stats.writebacks++;
+	}
+
+	cache_lines[victim].valid = 0;
+	return victim;
+}
+
+static int cache_insert(DWORD sector, const BYTE *data, BYTE dirty)
+{
+	int i = cache_find(sector);
+
+	if (i < 0 && (i = cache_victim()) < 0)
+		return -1;
+
+	memcpy(cache_data[i], data, SD_BLOCK_SIZE);
+	cache_lines[i].sector = sector;
+	cache_lines[i].lastuse = ++cache_clock;
+	cache_lines[i].valid = 1;
+	cache_lines[i].dirty = dirty;
+	return i;
+}
+
+/* Write every dirty sector back, joining consecutive ones into one transfer */
+static DRESULT cache_flush(void)
+{
+	while (true)
+	{
+		int first = -1;
+
+		for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+			if (cache_lines[i].valid && cache_lines[i].dirty
+				&& (first < 0 || cache_lines[i].sector < cache_lines[first].sector))
+				first = i;
+
+		if (first < 0)
+			return RES_OK;
+
+		DWORD sector = cache_lines[first].sector;
+		UINT count = 0;
+		int i = first;
+
+		do
+		{
+			memcpy(&cache_stage[count * SD_BLOCK_SIZE], cache_data[i], SD_BLOCK_SIZE);
+			count++;
+			i = cache_find(sector + count);
+		}
+		while (count < DISK_STAGE_SECTORS && i >= 0 && cache_lines[i].dirty);
+
+		if (dev_write(cache_stage, sector, count) != RES_OK)
+			return RES_ERROR;
+
+		for (UINT n = 0; n < count; n++)
+			cache_lines[cache_find(sector + n)].dirty = 0;
+		cache_stats.writebacks += count;
+	}
+}
+
+static DRESULT cache_read(BYTE *buff, DWORD sector, UINT count)
+{
+	if (count >= DISK_STAGE_SECTORS)
+	{
+		if (dev_read(buff, sector, count) != RES_OK)
+			return RES_ERROR;
+
+		/* sectors written since are newer here than on the card */
+		for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+			if (cache_lines[i].valid && cache_lines[i].dirty
+				&& cache_lines[i].sector - sector < count)
+				memcpy(buff + ((cache_lines[i].sector - sector) * SD_BLOCK_SIZE), cache_data[i], SD_BLOCK_SIZE);
+
+		cache_stats.misses += count;
+		cache_next = sector + count;
+		return RES_OK;
+	}
+
+	bool sequential = sector == cache_next;
+	cache_next = sector + count;
+
+	while (count > 0)
+	{
+		int i = cache_find(sector);
+		if (i >= 0)
+		{
+			memcpy(buff, cache_data[i], SD_BLOCK_SIZE);
+			cache_lines[i].lastuse = ++cache_clock;
+			cache_stats.hits++;
+			buff += SD_BLOCK_SIZE;
+			sector++;
+			count--;
+			continue;
+		}
+
+		/* fetch the run of missing sectors, and the read-ahead after it */
+		UINT run = 1;
+		while (run < count && cache_find(sector + run) < 0)
+			run++;
+
+		/* the read-ahead stops at a sector that is already cached: it may be */
+		/* dirty, and evicted to make room before this batch is inserted     */
+		UINT fetch = run;
+		if (sequential)
+			while (fetch < run + DISK_READAHEAD && fetch < DISK_STAGE_SECTORS && cache_find(sector + fetch) < 0)
+				fetch++;
+
+		if (dev_read(cache_stage, sector, fetch) != RES_OK)
+		{
+			/* the read-ahead may have run off the end of the card */
+			if (fetch == run || dev_read(cache_stage, sector, run) != RES_OK)
+				return RES_ERROR;
+			fetch = run;
+		}
+
+		cache_stats.misses += run;
+		cache_stats.readahead += fetch - run;
+
+		for (UINT n = 0; n < fetch; n++)
+			if (cache_insert(sector + n, &cache_stage[n * SD_BLOCK_SIZE], 0) < 0)
+				return RES_ERROR;
+
+		memcpy(buff, cache_stage, run * SD_BLOCK_SIZE);
+		buff += run * SD_BLOCK_SIZE;
+		sector += run;
+		count -= run;
+	}
+
+	return RES_OK;
+}
+
+static DRESULT cache_write(const BYTE *buff, DWORD sector, UINT count)
+{
+	if (count >= DISK_STAGE_SECTORS)
+	{
+		if (dev_write(buff, sector, count) != RES_OK)
+			return RES_ERROR;
+
+		/* keep cached copies in step with what was just written */
+		for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+			if (cache_lines[i].valid && cache_lines[i].sector - sector < count)
+			{
+				memcpy(cache_data[i], buff + ((cache_lines[i].sector - sector) * SD_BLOCK_SIZE), SD_BLOCK_SIZE);
+				cache_lines[i].dirty = 0;
+			}
+		return RES_OK;
+	}
+
+	for (UINT n = 0; n < count; n++)
+		if (cache_insert(sector + n, buff + (n * SD_BLOCK_SIZE), 1) < 0)
+			return RES_ERROR;
+
+	return RES_OK;
+}
+
+static void cache_discard(DWORD first, DWORD last)
+{
+	for (int i = 0; i < DISK_CACHE_SECTORS; i++)
+		if (cache_lines[i].valid && cache_lines[i].sector >= first && cache_lines[i].sector <= last)
+			cache_lines[i].valid = 0;
+}
+
+void disk_getcachestats(DISK_CACHESTATS *stats)
+{
+	*stats = cache_stats;
+}
+
+void disk_resetstats(void)
+{
+	memset(&cache_stats, 0, sizeof(cache_stats));
+	if (pEMMC)
+		pEMMC->ResetLatency();
 }
 
 
@@ -75,6 +370,14 @@ DSTATUS disk_status (
 	////	return stat;
 	//}
 	//return STA_NOINIT;
+
+	if (pdrv != DEV_MMC)
+		return STA_NOINIT;
+
+	/* the card is brought up by main(), or an image stands in for it */
+	if (!disk_image && !pEMMC)
+		return STA_NOINIT;
+
 	return 0;
 }
 
@@ -114,7 +417,8 @@ DSTATUS disk_initialize (
 	////	return stat;
 	//}
 	//return STA_NOINIT;
-	return 0;
+
+	return disk_status(pdrv);
 }
 
 
@@ -150,17 +454,7 @@ DRESULT disk_read (
 
 		//result = MMC_disk_read(buff, sector, count);
 
-//		g_pLogger->Write("", LogNotice, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!disk_read %d %d buf_size = 0x%x", sector, count, buf_size);
-
-		for (UINT s = 0; s < count; ++s)
-		{
-			if (sd_read(buff, SD_BLOCK_SIZE, sector+s) < SD_BLOCK_SIZE)
-			{
-				return RES_ERROR;
-			}
-			buff += SD_BLOCK_SIZE;
-		}
-		return RES_OK;
+		return cache_read(buff, sector, count);
 
 	//case DEV_USB :
 	//	// translate the arguments here
@@ -205,22 +499,8 @@ DRESULT disk_write (
 		// translate the arguments here
 
 		//result = MMC_disk_write(buff, sector, count);
-		//size_t buf_size = count * SD_BLOCK_SIZE;
-		//if (sd_write((uint8_t *)buff, buf_size, sector) < buf_size)
-		//{
-		//	return RES_ERROR;
-		//}
-
-		for (UINT s = 0; s < count; ++s)
-		{
-			if (sd_write((uint8_t *)buff, SD_BLOCK_SIZE, sector+s) < SD_BLOCK_SIZE)
-			{
-				return RES_ERROR;
-			}
-			buff += SD_BLOCK_SIZE;
-		}
 
-		return RES_OK;
+		return cache_write(buff, sector, count);
 
 	//case DEV_USB :
 	//	// translate the arguments here
@@ -270,6 +550,37 @@ DRESULT disk_ioctl (
 	//	return res;
 	//}
 
+	if (pdrv != DEV_MMC)
+		return RES_PARERR;
+
+	switch (cmd) {
+	case CTRL_SYNC :
+		return cache_flush();
+
+	case GET_SECTOR_COUNT :
+		*(DWORD*)buff = disk_image ? disk_imagesectors : pEMMC->GetSectorCount();
+		return *(DWORD*)buff ? RES_OK : RES_NOTRDY;
+
+	case GET_SECTOR_SIZE :
+		*(WORD*)buff = SD_BLOCK_SIZE;
+		return RES_OK;
+
+	case GET_BLOCK_SIZE :
+		*(DWORD*)buff = disk_image ? 1 : pEMMC->GetEraseBlockSize();
+		return RES_OK;
+
+	case CTRL_TRIM :
+	{
+		/* the sectors are free, so cached copies are dropped unwritten */
+		DWORD *range = (DWORD*)buff;
+		cache_discard(range[0], range[1]);
+
+		if (disk_image)
+			return RES_OK;
+		return pEMMC->DoErase(range[0], range[1]) == 0 ? RES_OK : RES_ERROR;
+	}
+	}
+
 	return RES_PARERR;
 }
 
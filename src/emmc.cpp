@@ -1,5 +1,6 @@
 #include "emmc.h"
 #include <assert.h>
+#include <string.h>
 
 extern "C"
 {
@@ -41,6 +42,14 @@ extern "C"
 // Enable card interrupts
 //#define SD_CARD_INTERRUPTS
 
+// Completion waits poll the register flat out for this long, which covers
+// most commands, then back off exponentially up to the second limit
+#define EMMC_SPIN_USEC		50
+#define EMMC_MAX_BACKOFF_USEC	1000
+
+// An erase holds the card busy; allow for a large range
+#define EMMC_ERASE_TIMEOUT	10000000
+
 #define	EMMC_ARG2		(ARM_EMMC_BASE + 0x00)
 #define EMMC_BLKSIZECNT		(ARM_EMMC_BASE + 0x04)
 #define EMMC_ARG1		(ARM_EMMC_BASE + 0x08)
@@ -386,8 +395,12 @@ const u32 CEMMCDevice::sd_acommands[] =
 
 CEMMCDevice::CEMMCDevice()
 :	m_ullOffset(0),
-	m_hci_ver(0)
+	m_hci_ver(0),
+	m_sector_count(0),
+	m_erase_sectors(1),
+	m_erase_single(0)
 {
+	ResetLatency();
 }
 
 CEMMCDevice::~CEMMCDevice(void)
@@ -705,10 +718,7 @@ void CEMMCDevice::IssueCommandInt(u32 cmd_reg, u32 argument, int timeout)
 
 #ifdef EMMC_POLL_STATUS_REG
 	// Check Command Inhibit
-	while(read32(EMMC_STATUS) & 1)
-	{
-		delay_us(1000);
-	}
+	TimeoutWait(EMMC_STATUS, 1, 0, timeout);
 
 	// Is the command with busy?
 	if ((cmd_reg & SD_CMD_RSPNS_TYPE_MASK) == SD_CMD_RSPNS_TYPE_48B)
@@ -721,10 +731,7 @@ void CEMMCDevice::IssueCommandInt(u32 cmd_reg, u32 argument, int timeout)
 			// Not an abort command
 
 			// Wait for the data line to be free
-			while(read32(EMMC_STATUS) & 2)
-			{
-				delay_us(1000);
-			}
+			TimeoutWait(EMMC_STATUS, 2, 0, timeout);
 		}
 	}
 #endif
@@ -744,6 +751,7 @@ void CEMMCDevice::IssueCommandInt(u32 cmd_reg, u32 argument, int timeout)
 	write32(EMMC_ARG1, argument);
 
 	// Set command reg
+	u32 start = read32(ARM_SYSTIMER_CLO);
 	write32(EMMC_CMDTM, cmd_reg);
 
 	//delay_us(2000);
@@ -806,42 +814,70 @@ void CEMMCDevice::IssueCommandInt(u32 cmd_reg, u32 argument, int timeout)
 			DEBUG_LOG("Multi block transfer");
 		}
 #endif
-		TimeoutWait(EMMC_INTERRUPT, wr_irpt | 0x8000, 1, timeout);
-		irpts = read32(EMMC_INTERRUPT);
-		write32(EMMC_INTERRUPT, 0xffff0000 | wr_irpt);
+		// The FIFO holds one block, so the controller raises read or write
+		// ready once per block of a multi block transfer
+		assert(m_block_size <= 1024);		// internal FIFO size of EMMC
+		assert((m_block_size & 3) == 0);
 
-		if ((irpts &(0xffff0000 | wr_irpt)) != wr_irpt)
+		u8 *pBlock =(u8 *) m_buf;
+		for (int block = 0; block < m_blocks_to_transfer; block++)
 		{
+			TimeoutWait(EMMC_INTERRUPT, wr_irpt | 0x8000, 1, timeout);
+			irpts = read32(EMMC_INTERRUPT);
+			write32(EMMC_INTERRUPT, 0xffff0000 | wr_irpt);
+
+			if ((irpts &(0xffff0000 | wr_irpt)) != wr_irpt)
+			{
 #ifdef EMMC_DEBUG
-			DEBUG_LOG("Error occured whilst waiting for data ready interrupt");
+				DEBUG_LOG("Error occured whilst waiting for data ready interrupt");
 #endif
-			m_last_error = irpts & 0xffff0000;
-			m_last_interrupt = irpts;
-
-			return;
-		}
-
-		// Transfer the block
-		assert(m_block_size <= 1024);		// internal FIFO size of EMMC
-		size_t length = m_block_size * m_blocks_to_transfer;
+				m_last_error = irpts & 0xffff0000;
+				m_last_interrupt = irpts;
 
-		assert(((u32) m_buf & 3) == 0);
-		assert((length & 3) == 0);
+				return;
+			}
 
-		u32 *pData =(u32 *) m_buf;
-		if (is_write)
-		{
-			for(; length > 0; length -= 4)
+			// Transfer the block; FatFs can hand over buffers that are not
+			// word aligned, and those go through memcpy a word at a time
+			size_t length = m_block_size;
+			if (((u32) pBlock & 3) == 0)
 			{
-				write32(EMMC_DATA, *pData++);
+				u32 *pData =(u32 *) pBlock;
+				if (is_write)
+				{
+					for(; length > 0; length -= 4)
+					{
+						write32(EMMC_DATA, *pData++);
+					}
+				}
+				else
+				{
+					for(; length > 0; length -= 4)
+					{
+						*pData++ = read32(EMMC_DATA);
+					}
+				}
 			}
-		}
-		else
-		{
-			for(; length > 0; length -= 4)
+			else
 			{
-				*pData++ = read32(EMMC_DATA);
+				u8 *pData = pBlock;
+				u32 word;
+				for(; length > 0; length -= 4, pData += 4)
+				{
+					if (is_write)
+					{
+						memcpy(&word, pData, 4);
+						write32(EMMC_DATA, word);
+					}
+					else
+					{
+						word = read32(EMMC_DATA);
+						memcpy(pData, &word, 4);
+					}
+				}
 			}
+
+			pBlock += m_block_size;
 		}
 
 #ifdef EMMC_DEBUG2
@@ -886,6 +922,30 @@ void CEMMCDevice::IssueCommandInt(u32 cmd_reg, u32 argument, int timeout)
 
 	// Return success
 	m_last_cmd_success = 1;
+	RecordLatency(cmd_reg, read32(ARM_SYSTIMER_CLO) - start);
+}
+
+// bucket n counts commands that took 2^(n-1) to 2^n - 1 microseconds
+void CEMMCDevice::RecordLatency(u32 cmd_reg, u32 usec)
+{
+	unsigned bucket = 0;
+	while (usec != 0 && bucket < EMMC_LATENCY_BUCKETS - 1)
+	{
+		usec >>= 1;
+		bucket++;
+	}
+
+	m_latency[(cmd_reg >> 24) & 0x3f][bucket]++;
+}
+
+void CEMMCDevice::GetLatency(unsigned command, u32 *buckets)
+{
+	memcpy(buckets, m_latency[command & 0x3f], sizeof(m_latency[0]));
+}
+
+void CEMMCDevice::ResetLatency(void)
+{
+	memset(m_latency, 0, sizeof(m_latency));
 }
 
 void CEMMCDevice::HandleCardInterrupt(void)
@@ -1555,6 +1615,19 @@ int CEMMCDevice::CardReset(void)
 	DEBUG_LOG("RCA: %04x\r\n", m_card_rca);
 #endif
 
+	// The CSD can only be read in the stand-by state, so before CMD7
+	if (!IssueCommand(SEND_CSD, m_card_rca << 16))
+	{
+		DEBUG_LOG("error sending SEND_CSD");
+
+		return -1;
+	}
+	m_csd[0] = m_last_r0;
+	m_csd[1] = m_last_r1;
+	m_csd[2] = m_last_r2;
+	m_csd[3] = m_last_r3;
+	ParseCSD();
+
 	// Now select the card(toggles it to transfer state)
 	if (!IssueCommand(SELECT_CARD, m_card_rca << 16))
 	{
@@ -1935,22 +2008,131 @@ int CEMMCDevice::DoWrite(u8 *buf, size_t buf_size, u32 block_no)
 	return buf_size;
 }
 
-int CEMMCDevice::TimeoutWait(unsigned reg, unsigned mask, int value, unsigned usec)
+// The controller drops the CRC of an R2 response, so CSD bit n is bit n - 8
+// of the response registers
+u32 CEMMCDevice::CSDField(unsigned start, unsigned width)
+{
+	u32 value = 0;
+
+	for (unsigned i = 0; i < width; i++)
+	{
+		unsigned bit = start - 8 + i;
+		value |= ((m_csd[bit / 32] >> (bit % 32)) & 1) << i;
+	}
+
+	return value;
+}
+
+// PLSS 5.3: capacity and erase sector size, both in 512 byte sectors
+void CEMMCDevice::ParseCSD(void)
 {
-	unsigned nCount = usec / 1000;
+	if (CSDField(126, 2) == 1)
+	{
+		// CSD version 2.0, SDHC and SDXC
+		m_sector_count = (CSDField(48, 22) + 1) * 1024;
+	}
+	else
+	{
+		u32 c_size = CSDField(62, 12);
+		u32 c_size_mult = CSDField(47, 3);
+		u32 read_bl_len = CSDField(80, 4);
+
+		// READ_BL_LEN is 9 to 11, so this stays within 32 bits for 4GB cards
+		m_sector_count = (c_size + 1) << (c_size_mult + 2 + read_bl_len - 9);
+	}
+
+	// erasable in single blocks if ERASE_BLK_EN, but this is the unit the
+	// card erases internally, so FatFs aligns to it
+	u32 write_bl_len = CSDField(22, 4);
+	m_erase_sectors = ((CSDField(39, 7) + 1) << write_bl_len) / SD_BLOCK_SIZE;
+	if (m_erase_sectors == 0)
+	{
+		m_erase_sectors = 1;
+	}
+	m_erase_single = CSDField(46, 1);
+
+#ifdef EMMC_DEBUG2
+	DEBUG_LOG("CSD: %u sectors, erase unit %u sectors\r\n", m_sector_count, m_erase_sectors);
+#endif
+}
+
+u32 CEMMCDevice::GetSectorCount(void)
+{
+	return m_sector_count;
+}
+
+u32 CEMMCDevice::GetEraseBlockSize(void)
+{
+	return m_erase_sectors;
+}
+
+// Erase sectors first to last inclusive. Cards without ERASE_BLK_EN erase
+// whole erase sectors, so the range is shrunk to those it covers entirely.
+int CEMMCDevice::DoErase(u32 first, u32 last)
+{
+	if (!m_erase_single)
+	{
+		first = (first + m_erase_sectors - 1) / m_erase_sectors * m_erase_sectors;
+		last = ((last + 1) / m_erase_sectors * m_erase_sectors) - 1;
+	}
+
+	if (last < first || last + 1 == 0)
+	{
+		return 0;
+	}
+
+	if (EnsureDataMode() != 0)
+	{
+		return -1;
+	}
+
+	// PLSS table 4.20 - SDSC cards use byte addresses rather than block addresses
+	if (!m_card_supports_sdhc)
+	{
+		first *= SD_BLOCK_SIZE;
+		last *= SD_BLOCK_SIZE;
+	}
 
-	do
+	if (   !IssueCommand(ERASE_WR_BLK_START, first)
+	    || !IssueCommand(ERASE_WR_BLK_END, last)
+	    || !IssueCommand(ERASE, 0, EMMC_ERASE_TIMEOUT))
 	{
-		delay_us(1);
+		DEBUG_LOG("error erasing sectors\r\n");
+
+		return -1;
+	}
+
+	return 0;
+}
 
+int CEMMCDevice::TimeoutWait(unsigned reg, unsigned mask, int value, unsigned usec)
+{
+	u32 start = read32(ARM_SYSTIMER_CLO);
+	u32 backoff = 1;
+
+	// the register is checked once more after each sleep, so a wait that
+	// overshoots the timeout still sees a late completion
+	while (true)
+	{
 		if ((read32(reg) & mask) ? value : !value)
 		{
 			return 0;
 		}
 
-		delay_us(999);
-	}
-	while(nCount--);
+		u32 elapsed = read32(ARM_SYSTIMER_CLO) - start;
+		if (elapsed >= usec)
+		{
+			return -1;
+		}
+
+		if (elapsed >= EMMC_SPIN_USEC)
+		{
+			delay_us(backoff);
 
-	return -1;
+			if (backoff < EMMC_MAX_BACKOFF_USEC)
+			{
+				backoff <<= 1;
+			}
+		}
+	}
 }
@@ -1,10 +1,22 @@
 #include "expr.h"
 #include "terminal.h"
 
+// every token of the longest expression can be on the stack at once
+static unsigned char expr_stack[EXPR_MAXLEN][EXPR_NUMSZ];
+static int expr_top = -1;
+
 int expr_eval(unsigned char* expr, double *result)
 {
 	int error = EXPR_ERR_NONE;
-	unsigned char *postfix = (unsigned char *)malloc(sizeof(unsigned char *) * 255);
+	unsigned char *postfix;
+
+	// a comma follows every token, so the postfix is at most twice as long
+	if (strlen((const char*)expr) >= EXPR_MAXLEN)
+		return EXPR_ERR_SYNTAX;
+
+	// an earlier syntax error can leave tokens behind
+	expr_top = -1;
+	postfix = (unsigned char *)malloc(EXPR_MAXLEN * 2);
 
 	error = expr_infix_to_postfix(expr, postfix);
 
@@ -37,7 +49,7 @@ void expr_spush(unsigned char *x)
 {
 	int ptr = 0;
 	expr_top++;
-	while (*x != 0)
+	while (*x != 0 && ptr < EXPR_NUMSZ - 1)
 	{
 		expr_stack[expr_top][ptr] = *x;
 		x++;
@@ -77,14 +89,14 @@ int expr_priority(unsigned char *x)
 
 int expr_infix_to_postfix(unsigned char *exp, unsigned char*postfix)
 {
-	unsigned char tkn[20];
+	unsigned char tkn[EXPR_NUMSZ];
 	unsigned char *p;
 	unsigned char *e;
 	int ptr = 0;
 	int ctr = 0;
 	int num = 0;
 
-	unsigned char exp2[160];
+	unsigned char exp2[EXPR_MAXLEN];
 	e = exp;
 
 	// eat spaces, and fix unary
@@ -201,7 +213,7 @@ int expr_infix_to_postfix(unsigned char *exp, unsigned char*postfix)
 				tkn[1] = 0;
 			}
 //term_printf("\n%d >= %d", expr_priority(expr_stack[expr_top]), expr_priority(tkn));
-			while (expr_priority(expr_stack[expr_top]) >= expr_priority(tkn))
+			while (expr_top != -1 && expr_priority(expr_stack[expr_top]) >= expr_priority(tkn))
 			{
 				
 				p = expr_spop();
@@ -233,10 +245,10 @@ int expr_infix_to_postfix(unsigned char *exp, unsigned char*postfix)
 
 int expr_eval_postfix(unsigned char* postfix, double* result)
 {
-	unsigned char tkn[20];
-	unsigned char sn1[10];
-	unsigned char sn2[10];
-	unsigned char sn3[10];
+	unsigned char tkn[EXPR_NUMSZ];
+	unsigned char sn1[EXPR_NUMSZ];
+	unsigned char sn2[EXPR_NUMSZ];
+	unsigned char sn3[EXPR_NUMSZ];
 
 	double n1 = 0;
 	double n2 = 0;
@@ -253,6 +265,8 @@ int expr_eval_postfix(unsigned char* postfix, double* result)
 		{
 			while ((*e > 47 && *e < 58) || *e == '~' || *e == '.')
 			{
+				if (ctr == EXPR_NUMSZ - 1)
+					return EXPR_ERR_SYNTAX;
 				if (*e == '~') 
 					*e = '-';
 				tkn[ctr++] = *(e++);
@@ -334,7 +348,8 @@ int expr_eval_postfix(unsigned char* postfix, double* result)
 				}
 			}
 		}
-		snprintf((char*)sn3, 10, "%f", n3);
+		// shortest text that atof reads back as the same double
+		fmt_shorttoa((char*)sn3, n3, 0);
 		expr_spush(sn3);
 		e++;
 	}
@@ -6,6 +6,7 @@ extern "C"
 #include<stdio.h>
 #include<string.h>
 #include<stdlib.h>
+#include "numfmt.h"
 
 #define EXPR_ERR_NONE			0
 #define EXPR_ERR_SYNTAX			1
@@ -15,8 +16,8 @@ extern "C"
 #define EXPR_TOKEN_OR			2
 #define EXPR_TOKEN_ABS			10
 
-	static unsigned char expr_stack[200][10];
-	static int expr_top = -1;
+#define EXPR_NUMSZ				FMT_SHORTLEN	// an operand on the evaluation stack, see fmt_shorttoa
+#define EXPR_MAXLEN				512		// an expression once its variables are replaced by numbers
 
 	int expr_eval(unsigned char* expr, double *result);
 	int expr_infix_to_postfix(unsigned char *exp, unsigned char*postfix);
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include "farray.h"
+
+struct farray
+{
+	int open;
+	FIL fil;
+	UINT elemsize;
+	DWORD count;
+	FSIZE_t bytes;			// count * elemsize
+	DWORD lastmiss;			// last page read from the file
+	int last;				// cache page of the last access
+};
+
+struct fpage
+{
+	int array;
+	DWORD page;
+	DWORD lastuse;
+	BYTE valid;
+	BYTE dirty;
+};
+
+static struct farray arrays[FARRAY_MAX];
+static struct fpage pages[FARRAY_PAGES];
+static BYTE page_data[FARRAY_PAGES][FARRAY_PAGE] __attribute__((aligned(4)));
+static BYTE page_stage[(FARRAY_READAHEAD + 1) * FARRAY_PAGE] __attribute__((aligned(4)));
+static const BYTE page_zeros[512];
+static DWORD page_clock;
+
+static struct farray *farray_find(int h)
+{
+	if (h < 0 || h >= FARRAY_MAX || !arrays[h].open)
+		return 0;
+	return &arrays[h];
+}
+
+static int page_find(int h, DWORD page)
+{
+	for (int i = 0; i < FARRAY_PAGES; i++)
+		if (pages[i].valid && pages[i].array == h && pages[i].page == page)
+			return i;
+	return -1;
+}
+
+// the part of a page inside the array; the file is never made longer than that
+static UINT page_bytes(struct farray *a, DWORD page)
+{
+	FSIZE_t start = (FSIZE_t)page * FARRAY_PAGE;
+	return a->bytes - start < FARRAY_PAGE ? (UINT)(a->bytes - start) : FARRAY_PAGE;
+}
+
+static FRESULT page_writeback(int i)
+{
+	struct farray *a = &arrays[pages[i].array];
+	FSIZE_t start = (FSIZE_t)pages[i].page * FARRAY_PAGE;
+	FSIZE_t size = f_size(&a->fil);
+	UINT len = page_bytes(a, pages[i].page);
+	FRESULT res;
+	UINT done;
+
+	// FAT has no holes, so anything between the end of the file and this
+	// page is written as zeros
+	res = f_lseek(&a->fil, start < size ? start : size);
+	while (res == FR_OK && f_tell(&a->fil) < start)
+	{
+		UINT gap = sizeof(page_zeros);
+		if (gap > start - f_tell(&a->fil))
+			gap = (UINT)(start - f_tell(&a->fil));
+
+		res = f_write(&a->fil, page_zeros, gap, &done);
+		if (res == FR_OK && done != gap)
+			res = FR_DENIED;		// the disk is full
+	}
+
+	if (res == FR_OK)
+		res = f_write(&a->fil, page_data[i], len, &done);
+	if (res == FR_OK && done != len)
+		res = FR_DENIED;
+
+	if (res == FR_OK)
+		pages[i].dirty = 0;
+	return res;
+}
+
+// A free page, or the least recently used one once it is written back
+static int page_victim(FRESULT *res)
+{
+	int victim = 0;
+
+	for (int i = 0; i < FARRAY_PAGES; i++)
+	{
+		if (!pages[i].valid)
+			return i;
+		if (pages[i].lastuse < pages[victim].lastuse)
+			victim = i;
+	}
+
+	if (pages[victim].dirty && (*res = page_writeback(victim)) != FR_OK)
+		return -1;
+
+	pages[victim].valid = 0;
+	return victim;
+}
+
+// Read page into the cache. After a miss on the page that follows the last
+// one read, the next FARRAY_READAHEAD pages come in the same read.
+static int page_load(int h, DWORD page, FRESULT *res)
+{
+	struct farray *a = &arrays[h];
+	DWORD lastpage = (DWORD)((a->bytes - 1) / FARRAY_PAGE);
+	UINT fetch = 1;
+	UINT got = 0;
+	int want = -1;
+
+	if (page == a->lastmiss + 1)
+		while (fetch < FARRAY_READAHEAD + 1 && page + fetch <= lastpage && page_find(h, page + fetch) < 0)
+			fetch++;
+
+	FSIZE_t start = (FSIZE_t)page * FARRAY_PAGE;
+	if (start < f_size(&a->fil))
+	{
+		*res = f_lseek(&a->fil, start);
+		if (*res == FR_OK)
+			*res = f_read(&a->fil, page_stage, fetch * FARRAY_PAGE, &got);
+		if (*res != FR_OK)
+			return -1;
+	}
+
+	// past the end of the file is zeros until it is written
+	memset(page_stage + got, 0, (fetch * FARRAY_PAGE) - got);
+
+	for (UINT n = 0; n < fetch; n++)
+	{
+		int i = page_victim(res);
+		if (i < 0)
+			return -1;
+
+		memcpy(page_data[i], page_stage + (n * FARRAY_PAGE), FARRAY_PAGE);
+		pages[i].array = h;
+		pages[i].page = page + n;
+		pages[i].lastuse = ++page_clock;
+		pages[i].valid = 1;
+		pages[i].dirty = 0;
+
+		if (n == 0)
+			want = i;
+	}
+
+	a->lastmiss = page + fetch - 1;
+	return want;
+}
+
+// the cache page holding element index, or -1 with *res set
+static int farray_page(int h, DWORD index, UINT *offset, FRESULT *res)
+{
+	struct farray *a = &arrays[h];
+	FSIZE_t pos = (FSIZE_t)index * a->elemsize;
+	DWORD page = (DWORD)(pos / FARRAY_PAGE);
+	int i = a->last;
+
+	*offset = (UINT)(pos % FARRAY_PAGE);
+
+	// most accesses are to the same page as the one before
+	if (i < 0 || !pages[i].valid || pages[i].array != h || pages[i].page != page)
+	{
+		i = page_find(h, page);
+		if (i < 0 && (i = page_load(h, page, res)) < 0)
+			return -1;
+		a->last = i;
+	}
+
+	pages[i].lastuse = ++page_clock;
+	return i;
+}
+
+FRESULT farray_open(const char *name, DWORD count, UINT elemsize, int *h)
+{
+	struct farray *a = 0;
+	FRESULT res;
+
+	// an element never spans two pages
+	if (count == 0 || elemsize == 0 || FARRAY_PAGE % elemsize != 0 || count > ((FSIZE_t)0 - 1) / elemsize)
+		return FR_INVALID_PARAMETER;
+
+	for (*h = 0; *h < FARRAY_MAX; (*h)++)
+		if (!arrays[*h].open)
+		{
+			a = &arrays[*h];
+			break;
+		}
+
+	if (!a)
+		return FR_TOO_MANY_OPEN_FILES;
+
+	memset(a, 0, sizeof(*a));
+	res = f_open(&a->fil, name, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+	if (res != FR_OK)
+		return res;
+
+	a->open = 1;
+	a->elemsize = elemsize;
+	a->count = count;
+	a->bytes = (FSIZE_t)count * elemsize;
+	a->lastmiss = (DWORD)0 - 1;		// so a scan from the start reads ahead
+	a->last = -1;
+	return FR_OK;
+}
+
+FRESULT farray_close(int h)
+{
+	struct farray *a = farray_find(h);
+	FRESULT res = FR_OK;
+
+	if (!a)
+		return FR_INVALID_OBJECT;
+
+	// written back in file order
+	for (int i = 0; i < FARRAY_PAGES; i++)
+	{
+		int first = -1;
+
+		for (int j = 0; j < FARRAY_PAGES; j++)
+			if (pages[j].valid && pages[j].array == h && (first < 0 || pages[j].page < pages[first].page))
+				first = j;
+
+		if (first < 0)
+			break;
+
+		if (pages[first].dirty)
+		{
+			FRESULT r = page_writeback(first);
+			if (res == FR_OK)
+				res = r;
+		}
+		pages[first].valid = 0;
+	}
+
+	FRESULT closeRes = f_close(&a->fil);
+	if (res == FR_OK)
+		res = closeRes;
+
+	a->open = 0;
+	return res;
+}
+
+void farray_closeall()
+{
+	for (int h = 0; h < FARRAY_MAX; h++)
+		if (arrays[h].open)
+			farray_close(h);
+}
+
+FRESULT farray_get(int h, DWORD index, void *value)
+{
+	struct farray *a = farray_find(h);
+	FRESULT res = FR_OK;
+	UINT offset;
+	int i;
+
+	if (!a)
+		return FR_INVALID_OBJECT;
+	if (index >= a->count)
+		return FR_INVALID_PARAMETER;
+
+	if ((i = farray_page(h, index, &offset, &res)) < 0)
+		return res;
+
+	memcpy(value, page_data[i] + offset, a->elemsize);
+	return FR_OK;
+}
+
+FRESULT farray_put(int h, DWORD index, const void *value)
+{
+	struct farray *a = farray_find(h);
+	FRESULT res = FR_OK;
+	UINT offset;
+	int i;
+
+	if (!a)
+		return FR_INVALID_OBJECT;
+	if (index >= a->count)
+		return FR_INVALID_PARAMETER;
+
+	if ((i = farray_page(h, index, &offset, &res)) < 0)
+		return res;
+
+	memcpy(page_data[i] + offset, value, a->elemsize);
+	pages[i].dirty = 1;
+	return FR_OK;
+}
+
+FRESULT farray_sync()
+{
+	FRESULT res = FR_OK;
+
+	for (int i = 0; i < FARRAY_PAGES; i++)
+	{
+		if (pages[i].valid && pages[i].dirty)
+		{
+			FRESULT r = page_writeback(i);
+			if (res == FR_OK)
+				res = r;
+		}
+	}
+
+	for (int h = 0; h < FARRAY_MAX; h++)
+	{
+		if (arrays[h].open)
+		{
+			FRESULT r = f_sync(&arrays[h].fil);
+			if (res == FR_OK)
+				res = r;
+		}
+	}
+
+	return res;
+}
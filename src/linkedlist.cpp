@@ -9,6 +9,45 @@ extern "C"
 
 static struct node *ll_head = NULL;
 static struct node *ll_current = NULL;
+static struct node *ll_tail = NULL;
+
+// the list is kept in line number order by ll_insert(); ll_insertFirst()
+// can break that, and ll_sort() puts it right again
+static bool ll_sorted = true;
+
+// every node in order, so a line can be found by binary search. Rebuilt on
+// the first lookup after the list changes.
+static struct node **ll_index = NULL;
+static int ll_indexcount = 0;
+static int ll_indexsize = 0;
+static bool ll_indexvalid = false;
+
+// refresh ll_index if the list changed; false if there was no memory for it,
+// in which case lookups walk the list instead
+static bool ll_rebuildindex()
+{
+	if (ll_indexvalid)
+		return true;
+
+	int length = ll_length();
+	if (length > ll_indexsize)
+	{
+		// grow in steps so typing a program in does not realloc every line
+		int size = length + 64;
+		struct node **index = (struct node**) realloc(ll_index, size * sizeof(struct node*));
+		if (index == NULL)
+			return false;
+		ll_index = index;
+		ll_indexsize = size;
+	}
+
+	ll_indexcount = 0;
+	for (struct node *n = ll_head; n != NULL; n = n->next)
+		ll_index[ll_indexcount++] = n;
+
+	ll_indexvalid = true;
+	return true;
+}
 
 struct node* ll_gethead()
 {
@@ -24,11 +63,79 @@ void ll_insertFirst(int linenum, unsigned char* data)
 	link->linenum = linenum;
 	link->data = data;
 
+	if (ll_head == NULL)
+		ll_tail = link;
+	else if (linenum > ll_head->linenum)
+		ll_sorted = false;
+
 	//point it to old first node
 	link->next = ll_head;
 
 	//point first to new first node
 	ll_head = link;
+	ll_indexvalid = false;
+}
+
+//insert link at the last location; lines loaded in order stay sorted
+void ll_insertLast(int linenum, unsigned char* data)
+{
+	struct node *link;
+
+	if (ll_tail == NULL)
+	{
+		ll_insertFirst(linenum, data);
+		return;
+	}
+
+	link = (struct node*) malloc(sizeof(struct node));
+	link->linenum = linenum;
+	link->data = data;
+	link->next = NULL;
+
+	if (linenum <= ll_tail->linenum)
+		ll_sorted = false;
+
+	ll_tail->next = link;
+	ll_tail = link;
+	ll_indexvalid = false;
+}
+
+//insert link in line number order
+void ll_insert(int linenum, unsigned char* data)
+{
+	struct node *link;
+	struct node *prev;
+
+	if (!ll_sorted)
+		ll_sort();
+
+	if (ll_head == NULL || linenum < ll_head->linenum)
+	{
+		ll_insertFirst(linenum, data);
+		return;
+	}
+
+	// programs are mostly typed and loaded in order, so try the end first
+	if (linenum > ll_tail->linenum)
+		prev = ll_tail;
+	else
+	{
+		// the last node before linenum; the index would have to be rebuilt
+		// after every insert, so just walk
+		prev = ll_head;
+		while (prev->next != NULL && prev->next->linenum < linenum)
+			prev = prev->next;
+	}
+
+	link = (struct node*) malloc(sizeof(struct node));
+	link->linenum = linenum;
+	link->data = data;
+	link->next = prev->next;
+	prev->next = link;
+
+	if (prev == ll_tail)
+		ll_tail = link;
+	ll_indexvalid = false;
 }
 
 //delete first item
@@ -41,6 +148,13 @@ struct node* ll_deleteFirst()
 	free(ll_head->data);
 	ll_head = ll_head->next;
 
+	if (ll_head == NULL)
+	{
+		ll_tail = NULL;
+		ll_sorted = true;
+	}
+	ll_indexvalid = false;
+
 	//return the deleted link
 	return tempLink;
 }
@@ -66,30 +180,42 @@ int ll_length()
 //find a link with given linenum
 struct node* ll_find(int linenum)
 {
+	struct node* ll_current = ll_seek(linenum);
 
-	//start from the first link
-	struct node* ll_current = ll_head;
-
-	//if list is empty
-	if (ll_head == NULL) {
+	if (ll_current == NULL || ll_current->linenum != linenum)
 		return NULL;
-	}
 
-	//navigate through list
-	while (ll_current->linenum != linenum) {
+	return ll_current;
+}
 
-		//if it is last node
-		if (ll_current->next == NULL) {
-			return NULL;
-		}
-		else {
-			//go to next link
+//first link at or after linenum, or NULL if there is none
+struct node* ll_seek(int linenum)
+{
+	if (!ll_sorted)
+		ll_sort();
+
+	if (ll_head == NULL || ll_tail->linenum < linenum)
+		return NULL;
+
+	if (!ll_rebuildindex())
+	{
+		struct node* ll_current = ll_head;
+		while (ll_current->linenum < linenum)
 			ll_current = ll_current->next;
-		}
+		return ll_current;
 	}
 
-	//if data found, return the current Link
-	return ll_current;
+	int lo = 0, hi = ll_indexcount - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (ll_index[mid]->linenum < linenum)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return ll_index[lo];
 }
 
 //delete a link with given linenum
@@ -131,41 +257,85 @@ struct node* ll_delete(int linenum)
 		ll_previous->next = ll_current->next;
 	}
 
+	if (ll_current == ll_tail)
+		ll_tail = ll_previous;
+	if (ll_head == NULL)
+		ll_sorted = true;
+	ll_indexvalid = false;
+
 	return ll_current;
 }
 
+// Bottom-up merge sort that relinks the nodes, so pointers to them stay
+// valid and a list loaded back to front sorts in n log n.
 void ll_sort()
 {
+	if (ll_sorted)
+		return;
 
-	int i, j, k, templinenum;
-	unsigned char *tempData;
-	struct node *ll_current;
-	struct node *ll_next;
-
-	int size = ll_length();
-	k = size;
+	struct node *list = ll_head;
 
-	for (i = 0; i < size - 1; i++, k--) {
-		ll_current = ll_head;
-		ll_next = ll_head->next;
+	for (int width = 1; ; width *= 2)
+	{
+		struct node *merged = NULL;
+		struct node *last = NULL;
+		int merges = 0;
 
-		for (j = 1; j < k; j++) {
+		while (list != NULL)
+		{
+			struct node *a = list;
+			struct node *b = list;
+			int asize = 0, bsize = width;
 
-			if (ll_current->linenum > ll_next->linenum)
+			merges++;
+			while (asize < width && b != NULL)
 			{
-				tempData = ll_current->data;
-				ll_current->data = ll_next->data;
-				ll_next->data = tempData;
+				b = b->next;
+				asize++;
+			}
 
-				templinenum = ll_current->linenum;
-				ll_current->linenum = ll_next->linenum;
-				ll_next->linenum = templinenum;
+			while (asize > 0 || (bsize > 0 && b != NULL))
+			{
+				struct node *next;
+
+				if (asize == 0)
+				{
+					next = b; b = b->next; bsize--;
+				}
+				else if (bsize == 0 || b == NULL || a->linenum <= b->linenum)
+				{
+					next = a; a = a->next; asize--;
+				}
+				else
+				{
+					next = b; b = b->next; bsize--;
+				}
+
+				if (last == NULL)
+					merged = next;
+				else
+					last->next = next;
+				last = next;
 			}
 
-			ll_current = ll_current->next;
-			ll_next = ll_next->next;
+			list = b;
 		}
+
+		if (last != NULL)
+			last->next = NULL;
+		list = merged;
+
+		if (merges <= 1)
+			break;
 	}
+
+	ll_head = list;
+	ll_tail = list;
+	while (ll_tail != NULL && ll_tail->next != NULL)
+		ll_tail = ll_tail->next;
+
+	ll_sorted = true;
+	ll_indexvalid = false;
 }
 
 void ll_reverse(struct node** ll_head_ref)
@@ -182,5 +352,14 @@ void ll_reverse(struct node** ll_head_ref)
 	}
 
 	*ll_head_ref = ll_prev;
+
+	if (ll_head_ref == &ll_head)
+	{
+		ll_tail = ll_head;
+		while (ll_tail != NULL && ll_tail->next != NULL)
+			ll_tail = ll_tail->next;
+		ll_sorted = false;
+		ll_indexvalid = false;
+	}
 }
 }
\ No newline at end of file
@@ -0,0 +1,988 @@
+#include <string.h>
+#include "numfmt.h"
+
+static const char fmt_digitpairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// exact in a double up to 1e22
+static const double fmt_pow10tab[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const uint64_t fmt_pow10u[] =
+{
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+	10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL
+};
+
+// write exactly 'count' decimal digits of value, zero padded on the left
+static void fmt_digits32(char *buf, uint32_t value, int count)
+{
+	while (count >= 2)
+	{
+		uint32_t pair = value % 100;
+		value /= 100;
+		count -= 2;
+		buf[count] = fmt_digitpairs[pair * 2];
+		buf[count + 1] = fmt_digitpairs[pair * 2 + 1];
+	}
+	if (count)
+		buf[0] = '0' + (value % 10);
+}
+
+static int fmt_len32(uint32_t value)
+{
+	int len = 1;
+	while (value >= 10)
+	{
+		value /= 10;
+		len++;
+	}
+	return len;
+}
+
+int fmt_utoa(char *buf, uint32_t value, unsigned base, int upper)
+{
+	const char *hexdigits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char tmp[33];
+	int len = 0;
+
+	if (base == 10)
+	{
+		len = fmt_len32(value);
+		fmt_digits32(buf, value, len);
+		buf[len] = 0;
+		return len;
+	}
+
+	do
+	{
+		tmp[len++] = hexdigits[value % base];
+		value /= base;
+	}
+	while (value);
+
+	for (int i = 0; i < len; i++)
+		buf[i] = tmp[len - 1 - i];
+	buf[len] = 0;
+	return len;
+}
+
+int fmt_itoa(char *buf, int32_t value)
+{
+	if (value < 0)
+	{
+		*buf = '-';
+		return 1 + fmt_utoa(buf + 1, -(uint32_t)value, 10, 0);
+	}
+	return fmt_utoa(buf, value, 10, 0);
+}
+
+int fmt_u64toa(char *buf, uint64_t value)
+{
+	// split into 9 digit groups so only the first division is 64 bit
+	uint32_t groups[3];
+	int count = 0;
+	int len;
+
+	if (value <= 0xffffffffULL)
+		return fmt_utoa(buf, (uint32_t)value, 10, 0);
+
+	while (value > 999999999ULL)
+	{
+		uint64_t q = value / 1000000000ULL;
+		groups[count++] = (uint32_t)(value - q * 1000000000ULL);
+		value = q;
+	}
+
+	len = fmt_utoa(buf, (uint32_t)value, 10, 0);
+	while (count)
+	{
+		fmt_digits32(buf + len, groups[--count], 9);
+		len += 9;
+	}
+	buf[len] = 0;
+	return len;
+}
+
+// Exact arithmetic for the cases the fast paths below cannot decide: a
+// rounding too close to call, and the far ends of the double range. Enough
+// words for a double's integer part, its fraction times 10^9, or n * 5^343.
+#define FMT_BIGWORDS	40
+#define FMT_EXACTLEN	(309 + FMT_MAXPREC + 2)		// integer digits of a double, then the fraction
+#define FMT_TINY		1e-290						// below this the double-double terms go subnormal
+#define FMT_HUGE		1e300						// above this the splitting in fmt_twoprod overflows
+
+typedef struct
+{
+	int len;						// words in use, the top one non-zero
+	uint32_t w[FMT_BIGWORDS];		// least significant first
+} fmt_big;
+
+static void big_set(fmt_big *b, uint64_t value)
+{
+	b->w[0] = (uint32_t)value;
+	b->w[1] = (uint32_t)(value >> 32);
+	b->len = b->w[1] ? 2 : (b->w[0] ? 1 : 0);
+}
+
+static void big_mul(fmt_big *b, uint32_t m)
+{
+	uint64_t carry = 0;
+
+	for (int i = 0; i < b->len; i++)
+	{
+		carry += (uint64_t)b->w[i] * m;
+		b->w[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+	if (carry)
+		b->w[b->len++] = (uint32_t)carry;
+}
+
+static void big_mulpow5(fmt_big *b, int e)
+{
+	for (; e >= 13; e -= 13)
+		big_mul(b, 1220703125);		// 5^13
+	if (e > 0)
+		big_mul(b, (uint32_t)(fmt_pow10u[e] >> e));
+}
+
+static void big_shl(fmt_big *b, int bits)
+{
+	int words = bits / 32;
+	bits %= 32;
+
+	if (b->len == 0)
+		return;
+
+	b->w[b->len] = 0;
+	for (int i = b->len; i >= 0; i--)
+	{
+		uint32_t w = b->w[i] << bits;
+		if (bits && i > 0)
+			w |= b->w[i - 1] >> (32 - bits);
+		b->w[i + words] = w;
+	}
+	for (int i = 0; i < words; i++)
+		b->w[i] = 0;
+
+	b->len += words + 1;
+	while (b->len > 0 && b->w[b->len - 1] == 0)
+		b->len--;
+}
+
+static int big_cmp(const fmt_big *a, const fmt_big *b)
+{
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+
+	for (int i = a->len - 1; i >= 0; i--)
+		if (a->w[i] != b->w[i])
+			return a->w[i] < b->w[i] ? -1 : 1;
+
+	return 0;
+}
+
+// b /= d, returning the remainder
+static uint32_t big_divmod(fmt_big *b, uint32_t d)
+{
+	uint64_t rem = 0;
+
+	for (int i = b->len - 1; i >= 0; i--)
+	{
+		rem = (rem << 32) | b->w[i];
+		b->w[i] = (uint32_t)(rem / d);
+		rem %= d;
+	}
+	while (b->len > 0 && b->w[b->len - 1] == 0)
+		b->len--;
+
+	return (uint32_t)rem;
+}
+
+// remove and return the bits of b from bit t up; they must fit in 32 bits
+static uint32_t big_split(fmt_big *b, int t)
+{
+	int word = t / 32;
+	int bits = t % 32;
+	uint32_t high = 0;
+
+	if (word < b->len)
+		high = b->w[word] >> bits;
+	if (bits && word + 1 < b->len)
+		high |= b->w[word + 1] << (32 - bits);
+
+	if (word < b->len)
+	{
+		b->w[word] &= bits ? (1u << bits) - 1 : 0;
+		b->len = word + 1;
+		while (b->len > 0 && b->w[b->len - 1] == 0)
+			b->len--;
+	}
+
+	return high;
+}
+
+// value (> 0) as m * 2^q
+static void fmt_decompose(double value, uint64_t *m, int *q)
+{
+	union { double d; uint64_t u; } bits;
+	int e;
+
+	bits.d = value;
+	e = (int)((bits.u >> 52) & 0x7ff);
+	*m = bits.u & 0xfffffffffffffULL;
+	if (e)
+		*m |= 1ULL << 52;
+	*q = (e ? e : 1) - 1075;
+}
+
+// Exact decimal digits of value (> 0). count is the number of significant
+// digits, or with fixed the number of digits after the point, in which case
+// the digits start at the first integer digit or at 10^-1. Rounded half to
+// even on the exact binary value, as glibc printf does. Returns the decimal
+// exponent of the first digit and the digit count in *ndigits.
+static int fmt_exact(double value, int count, int fixed, char *digits, int *ndigits)
+{
+	char buf[FMT_EXACTLEN];
+	fmt_big ip, fp;
+	uint64_t m;
+	int q, t = 0;
+	int nd = 0, e, wanted, next, sticky;
+
+	fmt_decompose(value, &m, &q);
+	big_set(&fp, 0);
+	if (q >= 0)
+	{
+		big_set(&ip, m);
+		big_shl(&ip, q);
+	}
+	else if (q > -64)
+	{
+		t = -q;
+		big_set(&ip, m >> t);
+		big_set(&fp, m & ((1ULL << t) - 1));
+	}
+	else
+	{
+		t = -q;
+		big_set(&ip, 0);
+		big_set(&fp, m);
+	}
+
+	// the integer part, nine digits at a time from the bottom
+	if (ip.len)
+	{
+		uint32_t groups[(309 + 8) / 9];
+		int ngroups = 0;
+
+		while (ip.len)
+			groups[ngroups++] = big_divmod(&ip, 1000000000);
+
+		nd = fmt_utoa(buf, groups[--ngroups], 10, 0);
+		while (ngroups)
+		{
+			fmt_digits32(buf + nd, groups[--ngroups], 9);
+			nd += 9;
+		}
+		e = nd - 1;
+	}
+	else
+		e = -1;
+
+	wanted = fixed ? (e >= 0 ? nd : 0) + count : count;
+
+	// leading zeros of a small value do not count, so skip them nine at a time
+	while (!fixed && nd == 0)
+	{
+		fmt_big next = fp;
+
+		big_mul(&next, 1000000000);
+		if (big_split(&next, t))
+			break;
+		fp = next;
+		e -= 9;
+	}
+
+	// then the fraction, up to one digit past the last one wanted
+	while (nd <= wanted && fp.len)
+	{
+		big_mul(&fp, 10);
+		int d = (int)big_split(&fp, t);
+
+		// leading zeros do not count as significant
+		if (!fixed && nd == 0 && d == 0)
+		{
+			e--;
+			continue;
+		}
+		buf[nd++] = '0' + d;
+	}
+	while (nd <= wanted)
+		buf[nd++] = '0';
+
+	next = buf[wanted] - '0';
+	sticky = fp.len != 0;
+	for (int i = wanted + 1; i < nd && !sticky; i++)
+		sticky = buf[i] != '0';
+
+	nd = wanted;
+	if (next > 5 || (next == 5 && (sticky || (wanted > 0 && ((buf[wanted - 1] - '0') & 1)))))
+	{
+		int i = wanted - 1;
+		while (i >= 0 && buf[i] == '9')
+			buf[i--] = '0';
+
+		if (i >= 0)
+			buf[i]++;
+		else
+		{
+			// carried into a new first digit
+			memmove(buf + 1, buf, nd);
+			buf[0] = '1';
+			e++;
+			if (fixed)
+				nd++;
+		}
+	}
+
+	memcpy(digits, buf, nd);
+	digits[nd] = 0;
+	*ndigits = nd;
+	return e;
+}
+
+// value * 10^e, dividing by exact powers where possible to limit rounding
+static double fmt_scale(double value, int e)
+{
+	while (e > 22)
+	{
+		value *= 1e22;
+		e -= 22;
+	}
+	while (e < -22)
+	{
+		value /= 1e22;
+		e += 22;
+	}
+
+	if (e >= 0)
+		return value * fmt_pow10tab[e];
+	return value / fmt_pow10tab[-e];
+}
+
+// Double-double helpers for digits beyond what one double can carry. These
+// rely on exact IEEE rounding, hence -fno-fast-math for this file.
+static void fmt_twoprod(double a, double b, double *hi, double *lo)
+{
+	double p = a * b;
+	double ca = 134217729.0 * a;
+	double cb = 134217729.0 * b;
+	double ah = ca - (ca - a);
+	double bh = cb - (cb - b);
+	double al = a - ah;
+	double bl = b - bh;
+	double err = ah * bh - p;
+
+	err = err + ah * bl;
+	err = err + al * bh;
+	*hi = p;
+	*lo = err + al * bl;
+}
+
+// value * 10^e as hi + lo, good to about 100 bits
+static void fmt_scale2(double value, int e, double *hi, double *lo)
+{
+	double h = value;
+	double l = 0;
+
+	while (e != 0)
+	{
+		int step = e > 22 ? 22 : (e < -22 ? 22 : (e < 0 ? -e : e));
+		double pow = fmt_pow10tab[step];
+		double ph, pl;
+
+		if (e > 0)
+		{
+			fmt_twoprod(h, pow, &ph, &pl);
+			pl = pl + l * pow;
+			h = ph + pl;
+			l = pl - (h - ph);
+			e -= step;
+		}
+		else
+		{
+			double q = h / pow;
+			double r;
+
+			fmt_twoprod(q, pow, &ph, &pl);
+			r = h - ph;
+			r = r - pl;
+			r = (r + l) / pow;
+			h = q + r;
+			l = r - (h - q);
+			e += step;
+		}
+	}
+
+	*hi = h;
+	*lo = l;
+}
+
+// round hi + lo (hi >= 0) to the nearest integer
+static uint64_t fmt_round2(double hi, double lo)
+{
+	uint64_t whole = (uint64_t)hi;
+	double frac = (hi - (double)whole) + lo + 0.5;
+	int64_t adjust = (int64_t)frac;
+
+	if ((double)adjust > frac)
+		adjust--;
+
+	return whole + adjust;
+}
+
+static int fmt_dtou_exact(double value, int ndigits, uint64_t *out)
+{
+	char digits[FMT_MAXDIGITS + 1];
+	uint64_t n = 0;
+	int nd;
+	int e = fmt_exact(value, ndigits, 0, digits, &nd);
+
+	for (int i = 0; i < nd; i++)
+		n = n * 10 + (digits[i] - '0');
+
+	*out = n;
+	return e;
+}
+
+// ndigits significant digits of value (> 0) as an integer n, value ~ n * 10^(e - ndigits + 1)
+static int fmt_dtou(double value, int ndigits, uint64_t *out)
+{
+	union { double d; uint64_t u; } bits;
+	uint64_t n = 0;
+	int e, e2;
+
+	// estimate the decimal exponent from the binary one (log10(2) ~ 78913 / 2^18)
+	bits.d = value;
+	e2 = (int)((bits.u >> 52) & 0x7ff) - 1023;
+	if (e2 == -1023)
+		e2 = -1074;
+	e = (e2 * 78913) >> 18;
+
+	if (value < FMT_TINY || value > FMT_HUGE)
+		return fmt_dtou_exact(value, ndigits, out);
+
+	// the estimate can be one off either way, and rounding can carry into a new digit
+	for (int tries = 0; tries < 4; tries++)
+	{
+		double hi, lo, err, dist;
+
+		// a bound on the error of the scaled value: up to 15 roundings in
+		// double, far less in double-double
+		if (ndigits > 9)
+		{
+			fmt_scale2(value, ndigits - 1 - e, &hi, &lo);
+			err = hi * 0x1p-80;
+		}
+		else
+		{
+			hi = fmt_scale(value, ndigits - 1 - e);
+			lo = 0;
+			err = hi * 0x1p-45;
+		}
+		n = fmt_round2(hi, lo);
+
+		// too close to halfway to trust the rounding, ties included. The
+		// whole part is exact in a double; n is within a couple of it.
+		uint64_t whole = (uint64_t)hi;
+		dist = ((hi - (double)whole) + lo) - (double)(int64_t)(n - whole);
+		if (dist < 0)
+			dist = -dist;
+		if (0.5 - dist <= err)
+			return fmt_dtou_exact(value, ndigits, out);
+
+		if (n >= fmt_pow10u[ndigits])
+			e++;
+		else if (n < fmt_pow10u[ndigits - 1])
+			e--;
+		else
+			break;
+	}
+
+	if (n >= fmt_pow10u[ndigits] || n < fmt_pow10u[ndigits - 1])
+		return fmt_dtou_exact(value, ndigits, out);
+
+	*out = n;
+	return e;
+}
+
+static void fmt_u64digits(char *digits, uint64_t n, int ndigits)
+{
+	if (ndigits > 9)
+	{
+		uint32_t high = (uint32_t)(n / 1000000000ULL);
+		fmt_digits32(digits, high, ndigits - 9);
+		fmt_digits32(digits + ndigits - 9, (uint32_t)(n - (uint64_t)high * 1000000000ULL), 9);
+	}
+	else
+		fmt_digits32(digits, (uint32_t)n, ndigits);
+
+	digits[ndigits] = 0;
+}
+
+int fmt_dtod(double value, int ndigits, char *digits)
+{
+	uint64_t n;
+	int e;
+
+	if (ndigits < 1)
+		ndigits = 1;
+	if (ndigits > FMT_MAXDIGITS)
+		ndigits = FMT_MAXDIGITS;
+
+	if (value < 0)
+		value = -value;
+
+	if (value == 0)
+	{
+		memset(digits, '0', ndigits);
+		digits[ndigits] = 0;
+		return 0;
+	}
+
+	e = fmt_dtou(value, ndigits, &n);
+	fmt_u64digits(digits, n, ndigits);
+	return e;
+}
+
+// value (> 0) as m * 2^q at double or float precision
+static void fmt_mantissa(double value, int single, uint64_t *m, int *q)
+{
+	if (single)
+	{
+		union { float f; uint32_t u; } bits;
+		int e;
+
+		bits.f = (float)value;
+		e = (int)((bits.u >> 23) & 0xff);
+		*m = bits.u & 0x7fffff;
+		if (e)
+			*m |= 1 << 23;
+		*q = (e ? e : 1) - 150;
+	}
+	else
+		fmt_decompose(value, m, q);
+}
+
+// compare n * 10^k with mid * 2^j exactly
+static int fmt_cmp10(uint64_t n, int k, uint64_t mid, int j)
+{
+	fmt_big a, b;
+
+	big_set(&a, n);
+	big_set(&b, mid);
+	if (k >= 0)
+		big_mulpow5(&a, k);
+	else
+		big_mulpow5(&b, -k);
+
+	// n * 5^k * 2^k against mid * 2^j
+	if (k - j >= 0)
+		big_shl(&a, k - j);
+	else
+		big_shl(&b, j - k);
+
+	return big_cmp(&a, &b);
+}
+
+// Does n * 10^k round to value? It must lie between the midpoints to the
+// neighbouring values, and a tie goes to the even mantissa, as in strtod.
+static int fmt_roundtrips_exact(double value, uint64_t n, int k, int single)
+{
+	uint64_t m;
+	int q, c, minnormal;
+
+	fmt_mantissa(value, single, &m, &q);
+	minnormal = m == (single ? (1ULL << 23) : (1ULL << 52)) && q > (single ? -149 : -1074);
+
+	c = fmt_cmp10(n, k, 2 * m + 1, q - 1);
+	if (c > 0 || (c == 0 && (m & 1)))
+		return 0;
+
+	// below a power of two the gap to the next value down is half as wide
+	c = minnormal ? fmt_cmp10(n, k, 4 * m - 1, q - 2) : fmt_cmp10(n, k, 2 * m - 1, q - 1);
+	if (c < 0 || (c == 0 && (m & 1)))
+		return 0;
+
+	return 1;
+}
+
+// half the gap from value (> 0) to its neighbour above, or below
+static double fmt_halfgap(double value, int single, int below)
+{
+	union { double d; uint64_t u; } pow2;
+	uint64_t m;
+	int q;
+
+	fmt_mantissa(value, single, &m, &q);
+	if (below && m == (single ? (1ULL << 23) : (1ULL << 52)) && q > (single ? -149 : -1074))
+		q--;
+
+	pow2.u = (uint64_t)(q - 1 + 1023) << 52;
+	return pow2.d;
+}
+
+// Does n * 10^k read back as value? FMT_SINGLE values are read with
+// strtof rounding, everything else with strtod rounding.
+static int fmt_roundtrips(double value, uint64_t n, int k, int single)
+{
+	double hi, lo = 0, margin, diff, half;
+
+	// one correctly rounded operation when both factors are exact
+	if (!single && n <= (1ULL << 53) && k <= 22 && k >= -22)
+		return (k >= 0 ? (double)n * fmt_pow10tab[k] : (double)n / fmt_pow10tab[-k]) == value;
+
+	if (single)
+	{
+		// n has at most 9 digits, so this is a few roundings at most
+		value = (float)value;
+		hi = fmt_scale((double)n, k);
+		margin = value * 0x1p-45;
+	}
+	else if (value < FMT_TINY || value > FMT_HUGE)
+		return fmt_roundtrips_exact(value, n, k, single);
+	else
+	{
+		// n as an exact sum of two doubles, then scaled in double-double
+		double nh = (double)(n & ~0x7ffULL);
+		fmt_scale2(nh, k, &hi, &lo);
+		if (n & 0x7ff)
+		{
+			double th, tl;
+			fmt_scale2((double)(n & 0x7ff), k, &th, &tl);
+			double sum = hi + th;
+			lo = lo + tl + (th - (sum - hi));
+			hi = sum;
+		}
+		margin = value * 0x1p-75;
+	}
+
+	// decided by how far n * 10^k is from value against half the gap to the
+	// neighbouring value, unless that is too close to call
+	diff = (hi - value) + lo;
+	half = fmt_halfgap(value, single, diff < 0);
+	if (diff < 0)
+		diff = -diff;
+
+	if (diff < half - margin)
+		return 1;
+	if (diff > half + margin)
+		return 0;
+	return fmt_roundtrips_exact(value, n, k, single);
+}
+
+int fmt_shortest(double value, int single, char *digits)
+{
+	uint64_t n;
+	int lo = 1;
+	int hi = single ? FMT_SINGLEDIGITS : FMT_MAXDIGITS;
+	int e, ndigits;
+
+	if (value < 0)
+		value = -value;
+	if (single)
+		value = (float)value;
+
+	if (value == 0)
+	{
+		strcpy(digits, "0");
+		return 0;
+	}
+
+	// fewest correctly rounded digits that read back as the same number
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+
+		e = fmt_dtou(value, mid, &n);
+		if (fmt_roundtrips(value, n, e - mid + 1, single))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	e = fmt_dtou(value, lo, &n);
+	fmt_u64digits(digits, n, lo);
+
+	ndigits = lo;
+	while (ndigits > 1 && digits[ndigits - 1] == '0')
+		ndigits--;
+	digits[ndigits] = 0;
+
+	return e;
+}
+
+// handles sign, infinity and nan; returns 0 if the caller should carry on
+static int fmt_special(char **p, double *value)
+{
+	union { double d; uint64_t u; } bits;
+	bits.d = *value;
+
+	if (bits.u >> 63)
+	{
+		*(*p)++ = '-';
+		*value = -*value;
+	}
+
+	if (((bits.u >> 52) & 0x7ff) == 0x7ff)
+	{
+		strcpy(*p, (bits.u & 0xfffffffffffffULL) ? "nan" : "inf");
+		*p += 3;
+		return 1;
+	}
+
+	return 0;
+}
+
+// lay out digits d0.d1d2... x 10^e as a fixed point number with prec decimals.
+// Positions past the available digits are zero.
+static char *fmt_fixed(char *p, const char *digits, int ndigits, int e, int prec)
+{
+	if (e < 0)
+		*p++ = '0';
+	else
+		for (int i = 0; i <= e; i++)
+			*p++ = i < ndigits ? digits[i] : '0';
+
+	if (prec > 0)
+	{
+		*p++ = '.';
+		for (int i = 0; i < prec; i++)
+		{
+			int pos = e + 1 + i;
+			*p++ = (pos >= 0 && pos < ndigits) ? digits[pos] : '0';
+		}
+	}
+
+	return p;
+}
+
+static char *fmt_exponent(char *p, const char *digits, int ndigits, int e, int prec, int upper)
+{
+	*p++ = digits[0];
+	if (prec > 0)
+	{
+		*p++ = '.';
+		for (int i = 1; i <= prec; i++)
+			*p++ = i < ndigits ? digits[i] : '0';
+	}
+
+	*p++ = upper ? 'E' : 'e';
+	if (e < 0)
+	{
+		*p++ = '-';
+		e = -e;
+	}
+	else
+		*p++ = '+';
+
+	if (e < 10)
+		*p++ = '0';
+	p += fmt_utoa(p, e, 10, 0);
+
+	return p;
+}
+
+int fmt_ftoa(char *buf, double value, int prec)
+{
+	char digits[FMT_EXACTLEN];
+	char *p = buf;
+	int ndigits = 0, e = -1;
+
+	if (prec < 0)
+		prec = 6;
+	if (prec > FMT_MAXPREC)
+		prec = FMT_MAXPREC;
+
+	if (fmt_special(&p, &value))
+	{
+		*p = 0;
+		return p - buf;
+	}
+
+	// every digit printf would give, from the exact binary value
+	if (value != 0)
+		e = fmt_exact(value, prec, 1, digits, &ndigits);
+	p = fmt_fixed(p, digits, ndigits, e, prec);
+
+	*p = 0;
+	return p - buf;
+}
+
+// ndigits (up to FMT_MAXPREC + 1) significant digits; past what a double
+// carries they are the exact ones, as from printf
+static int fmt_sigdigits(double value, int ndigits, char *digits)
+{
+	if (ndigits <= FMT_MAXDIGITS || value == 0)
+	{
+		int e = fmt_dtod(value, ndigits < FMT_MAXDIGITS ? ndigits : FMT_MAXDIGITS, digits);
+		for (int i = FMT_MAXDIGITS; i < ndigits; i++)
+			digits[i] = '0';
+		digits[ndigits] = 0;
+		return e;
+	}
+
+	return fmt_exact(value, ndigits, 0, digits, &ndigits);
+}
+
+int fmt_etoa(char *buf, double value, int prec, int upper)
+{
+	char digits[FMT_MAXPREC + 2];
+	char *p = buf;
+	int ndigits, e;
+
+	if (prec < 0)
+		prec = 6;
+	if (prec > FMT_MAXPREC)
+		prec = FMT_MAXPREC;
+
+	if (fmt_special(&p, &value))
+	{
+		*p = 0;
+		return p - buf;
+	}
+
+	ndigits = prec + 1;
+	e = fmt_sigdigits(value, ndigits, digits);
+	p = fmt_exponent(p, digits, ndigits, e, prec, upper);
+
+	*p = 0;
+	return p - buf;
+}
+
+int fmt_gtoa(char *buf, double value, int prec, int alt)
+{
+	char digits[FMT_MAXPREC + 2];
+	char *p = buf;
+	char *start;
+	int ndigits, e;
+
+	if (prec < 0)
+		prec = 6;
+	if (prec == 0)
+		prec = 1;
+	if (prec > FMT_MAXPREC)
+		prec = FMT_MAXPREC;
+
+	if (fmt_special(&p, &value))
+	{
+		*p = 0;
+		return p - buf;
+	}
+
+	ndigits = prec;
+	e = fmt_sigdigits(value, ndigits, digits);
+	if (value == 0)
+		e = 0;
+
+	start = p;
+	if (e < -4 || e >= prec)
+		p = fmt_exponent(p, digits, ndigits, e, prec - 1, 0);
+	else
+		p = fmt_fixed(p, digits, ndigits, e, prec - 1 - e);
+
+	if (!alt)
+	{
+		// strip trailing zeros of the fraction, keeping any exponent
+		char *exp = start;
+		while (exp < p && *exp != 'e')
+			exp++;
+
+		char *frac = start;
+		while (frac < exp && *frac != '.')
+			frac++;
+
+		if (frac < exp)
+		{
+			char *end = exp;
+			while (end > frac && end[-1] == '0')
+				end--;
+			if (end == frac + 1)
+				end = frac;
+
+			int explen = p - exp;
+			memmove(end, exp, explen);
+			p = end + explen;
+		}
+	}
+
+	*p = 0;
+	return p - buf;
+}
+
+int fmt_shorttoa(char *buf, double value, int flags)
+{
+	char digits[FMT_MAXDIGITS + 1];
+	char *p = buf;
+	int single = flags & FMT_SINGLE;
+	int ndigits, e, maxdigits;
+
+	if (fmt_special(&p, &value))
+	{
+		*p = 0;
+		return p - buf;
+	}
+
+	// Commodore BASIC puts a space where the sign would go
+	if ((flags & FMT_CBM) && p == buf)
+		*p++ = ' ';
+
+	e = fmt_shortest(value, single, digits);
+	ndigits = strlen(digits);
+	maxdigits = single ? FMT_SINGLEDIGITS : FMT_MAXDIGITS;
+
+	if (flags & FMT_PLAIN)
+		p = fmt_fixed(p, digits, ndigits, e, ndigits - 1 - e > 0 ? ndigits - 1 - e : 0);
+	else if (flags & FMT_CBM)
+	{
+		// fixed from .01 to 999999999, otherwise 1.5E+10 style
+		if (e < -2 || e >= FMT_SINGLEDIGITS)
+			p = fmt_exponent(p, digits, ndigits, e, ndigits - 1, 1);
+		else if (e < 0)
+		{
+			*p++ = '.';
+			for (int i = e + 1; i < 0; i++)
+				*p++ = '0';
+			memcpy(p, digits, ndigits);
+			p += ndigits;
+		}
+		else
+			p = fmt_fixed(p, digits, ndigits, e, ndigits - 1 - e > 0 ? ndigits - 1 - e : 0);
+	}
+	else
+	{
+		// same choice of layout as %g
+		if (e < -4 || e >= maxdigits)
+			p = fmt_exponent(p, digits, ndigits, e, ndigits - 1, 0);
+		else
+			p = fmt_fixed(p, digits, ndigits, e, ndigits - 1 - e > 0 ? ndigits - 1 - e : 0);
+	}
+
+	*p = 0;
+	return p - buf;
+}
@@ -137,6 +137,33 @@ void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... )
             break;
 
 
+        case TAG_SET_VSYNC:
+            /* Blocks until the next vertical sync */
+            pt[pt_index++] = 4;
+            pt[pt_index++] = 0; /* Request */
+            pt[pt_index++] = va_arg( vl, int );
+            break;
+
+        case TAG_SET_CURSOR_INFO:
+            pt[pt_index++] = 24;
+            pt[pt_index++] = 0; /* Request */
+            pt[pt_index++] = va_arg( vl, int ); /* Width */
+            pt[pt_index++] = va_arg( vl, int ); /* Height */
+            pt[pt_index++] = 0;                 /* Unused */
+            pt[pt_index++] = va_arg( vl, int ); /* Bus address of the ARGB pixels */
+            pt[pt_index++] = va_arg( vl, int ); /* Hotspot x */
+            pt[pt_index++] = va_arg( vl, int ); /* Hotspot y */
+            break;
+
+        case TAG_SET_CURSOR_STATE:
+            pt[pt_index++] = 16;
+            pt[pt_index++] = 0; /* Request */
+            pt[pt_index++] = va_arg( vl, int ); /* Enable */
+            pt[pt_index++] = va_arg( vl, int ); /* x */
+            pt[pt_index++] = va_arg( vl, int ); /* y */
+            pt[pt_index++] = va_arg( vl, int ); /* Flags, 1 for framebuffer rather than display coordinates */
+            break;
+
         case TAG_GET_ALPHA_MODE:
         case TAG_SET_ALPHA_MODE:
         case TAG_GET_DEPTH:
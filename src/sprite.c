@@ -0,0 +1,358 @@
+#include "vga.h"
+#include "sprite.h"
+
+struct sprite_rect
+{
+	int x1, y1, x2, y2;		// half open, clipped to the screen
+};
+
+struct sprite
+{
+	int defined;
+	int visible;
+	int x, y, w, h;
+	u8 *pixels;				// w * h in framebuffer format
+	u16 *runs;				// per row: run count, then start,length pairs
+	u32 *rows;				// offset of each row in runs
+	u32 pending;			// bit p: page p does not show the latest state yet
+	int drawn[2];
+	struct sprite_rect under[2];
+	u8 *saved[2];			// what was under it on each page
+	u32 savedsize[2];
+};
+
+static struct sprite sprites[SPRITE_MAX];
+static u32 sprite_pagepending;
+
+static int sprite_page()
+{
+	return vga_framebuffer == vga_pages[1] ? 1 : 0;
+}
+
+static int sprite_rectof(struct sprite *s, struct sprite_rect *r)
+{
+	r->x1 = s->x;
+	r->y1 = s->y;
+	r->x2 = s->x + s->w;
+	r->y2 = s->y + s->h;
+	return vga_cliprect(&r->x1, &r->y1, &r->x2, &r->y2);
+}
+
+static int sprite_overlap(const struct sprite_rect *a, const struct sprite_rect *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static void sprite_restore(struct sprite *s, int p)
+{
+	struct sprite_rect *r = &s->under[p];
+	u32 bytes = vga_bpp >> 3;
+	u32 rowbytes = (r->x2 - r->x1) * bytes;
+	u8 *src = s->saved[p];
+
+	if (!s->drawn[p])
+		return;
+
+	for (int y = r->y1; y < r->y2; y++)
+	{
+		memcpy(&vga_pages[p][(r->x1 * bytes) + (y * vga_pitch)], src, rowbytes);
+		src += rowbytes;
+	}
+
+	s->drawn[p] = 0;
+}
+
+static void sprite_draw(struct sprite *s, int p)
+{
+	struct sprite_rect r;
+	u32 bytes = vga_bpp >> 3;
+	u8 *page = vga_pages[p];
+
+	if (!sprite_rectof(s, &r))
+		return;
+
+	// save the background first
+	u32 rowbytes = (r.x2 - r.x1) * bytes;
+	u32 size = rowbytes * (r.y2 - r.y1);
+	if (size > s->savedsize[p])
+	{
+		free(s->saved[p]);
+		s->saved[p] = (u8*)malloc(size);
+		s->savedsize[p] = s->saved[p] ? size : 0;
+		if (!s->saved[p])
+			return;
+	}
+
+	u8 *dst = s->saved[p];
+	for (int y = r.y1; y < r.y2; y++)
+	{
+		memcpy(dst, &page[(r.x1 * bytes) + (y * vga_pitch)], rowbytes);
+		dst += rowbytes;
+	}
+
+	// then copy the opaque runs of each visible row
+	for (int y = r.y1; y < r.y2; y++)
+	{
+		int row = y - s->y;
+		u16 *run = &s->runs[s->rows[row]];
+		u16 count = *run++;
+		u8 *line = &page[y * vga_pitch];
+		u8 *src = &s->pixels[row * s->w * bytes];
+
+		for (int i = 0; i < count; i++, run += 2)
+		{
+			int a = s->x + run[0];
+			int b = a + run[1];
+
+			if (a < r.x1)
+				a = r.x1;
+			if (b > r.x2)
+				b = r.x2;
+			if (a < b)
+				memcpy(&line[a * bytes], &src[(a - s->x) * bytes], (b - a) * bytes);
+		}
+	}
+
+	s->under[p] = r;
+	s->drawn[p] = 1;
+}
+
+static void sprite_updatepage(int p)
+{
+	struct sprite_rect oldr[SPRITE_MAX], newr[SPRITE_MAX];
+	u32 redraw = 0;
+	int changed;
+
+	if (!(sprite_pagepending & (1 << p)) || vga_pages[p] == 0)
+		return;
+
+	for (int i = 0; i < SPRITE_MAX; i++)
+	{
+		struct sprite *s = &sprites[i];
+
+		if (s->drawn[p])
+			oldr[i] = s->under[p];
+		else
+			oldr[i].x1 = oldr[i].x2 = 0;
+
+		if (!s->defined || !s->visible || !sprite_rectof(s, &newr[i]))
+			newr[i].x1 = newr[i].x2 = 0;
+
+		if (s->pending & (1 << p))
+			redraw |= 1 << i;
+	}
+
+	// anything drawn that overlaps a sprite being redrawn has to be lifted too,
+	// so the stacking order stays right
+	do
+	{
+		changed = 0;
+		for (int i = 0; i < SPRITE_MAX; i++)
+		{
+			if ((redraw & (1 << i)) || !sprites[i].drawn[p])
+				continue;
+
+			for (int j = 0; j < SPRITE_MAX; j++)
+			{
+				if (!(redraw & (1 << j)))
+					continue;
+				if (sprite_overlap(&oldr[i], &oldr[j]) || sprite_overlap(&oldr[i], &newr[j]))
+				{
+					redraw |= 1 << i;
+					changed = 1;
+					break;
+				}
+			}
+		}
+	}
+	while (changed);
+
+	// restore in reverse of drawing order, then draw lowest number first
+	for (int i = SPRITE_MAX - 1; i >= 0; i--)
+		if (redraw & (1 << i))
+			sprite_restore(&sprites[i], p);
+
+	for (int i = 0; i < SPRITE_MAX; i++)
+	{
+		if (!(redraw & (1 << i)))
+			continue;
+		if (sprites[i].defined && sprites[i].visible)
+			sprite_draw(&sprites[i], p);
+		sprites[i].pending &= ~(1 << p);
+	}
+
+	sprite_pagepending &= ~(1 << p);
+}
+
+void sprite_update()
+{
+	sprite_updatepage(sprite_page());
+}
+
+static void sprite_touch(struct sprite *s)
+{
+	s->pending = 3;
+	sprite_pagepending = 3;
+}
+
+int sprite_define(int n, int x, int y, int w, int h)
+{
+	u32 bytes = vga_bpp >> 3;
+
+	if (n < 0 || n >= SPRITE_MAX || w <= 0 || h <= 0 || w > SPRITE_MAXSIZE || h > SPRITE_MAXSIZE)
+		return 0;
+	if (x < 0 || y < 0 || x + w > (int)vga_width || y + h > (int)vga_height)
+		return 0;
+
+	u8 *pixels = (u8*)malloc(w * h * bytes);
+	// a row of w pixels has at most (w + 1) / 2 runs: a count, then two entries each
+	u16 *runs = (u16*)malloc(h * (w + 2) * sizeof(u16));
+	u32 *rows = (u32*)malloc(h * sizeof(u32));
+
+	if (!pixels || !runs || !rows)
+	{
+		free(pixels);
+		free(runs);
+		free(rows);
+		return 0;
+	}
+
+	u32 key = vga_pixelvalue(vga_getbackcolor());
+	u32 used = 0;
+
+	for (int row = 0; row < h; row++)
+	{
+		memcpy(&pixels[row * w * bytes], &vga_framebuffer[(x * bytes) + ((y + row) * vga_pitch)], w * bytes);
+
+		rows[row] = used;
+		u16 *count = &runs[used++];
+		*count = 0;
+
+		for (int col = 0; col < w;)
+		{
+			while (col < w && vga_getpixel(x + col, y + row) == key)
+				col++;
+			if (col == w)
+				break;
+
+			int start = col;
+			while (col < w && vga_getpixel(x + col, y + row) != key)
+				col++;
+
+			runs[used++] = start;
+			runs[used++] = col - start;
+			(*count)++;
+		}
+	}
+
+	struct sprite *s = &sprites[n];
+
+	// the old bitmap can go now; the saved backgrounds stay until it is lifted
+	free(s->pixels);
+	free(s->runs);
+	free(s->rows);
+
+	s->pixels = pixels;
+	s->runs = runs;
+	s->rows = rows;
+	s->w = w;
+	s->h = h;
+
+	if (!s->defined)
+	{
+		s->x = x;
+		s->y = y;
+		s->visible = 0;
+		s->defined = 1;
+	}
+
+	sprite_touch(s);
+	return 1;
+}
+
+int sprite_move(int n, int x, int y)
+{
+	if (n < 0 || n >= SPRITE_MAX || !sprites[n].defined)
+		return 0;
+
+	struct sprite *s = &sprites[n];
+	if (s->visible && s->x == x && s->y == y)
+		return 1;
+
+	s->x = x;
+	s->y = y;
+	s->visible = 1;
+	sprite_touch(s);
+	return 1;
+}
+
+int sprite_off(int n)
+{
+	if (n < 0 || n >= SPRITE_MAX || !sprites[n].defined)
+		return 0;
+
+	if (sprites[n].visible)
+	{
+		sprites[n].visible = 0;
+		sprite_touch(&sprites[n]);
+	}
+	return 1;
+}
+
+void sprite_reset()
+{
+	for (int i = 0; i < SPRITE_MAX; i++)
+		if (sprites[i].visible)
+		{
+			sprites[i].visible = 0;
+			sprite_touch(&sprites[i]);
+		}
+
+	sprite_updatepage(0);
+	sprite_updatepage(1);
+
+	for (int i = 0; i < SPRITE_MAX; i++)
+	{
+		struct sprite *s = &sprites[i];
+		free(s->pixels);
+		free(s->runs);
+		free(s->rows);
+		free(s->saved[0]);
+		free(s->saved[1]);
+		memset(s, 0, sizeof(*s));
+	}
+
+	sprite_pagepending = 0;
+}
+
+void sprite_clonepage(int from, int to)
+{
+	for (int i = 0; i < SPRITE_MAX; i++)
+	{
+		struct sprite *s = &sprites[i];
+
+		s->drawn[to] = 0;
+		if (!s->drawn[from])
+			continue;
+
+		struct sprite_rect *r = &s->under[from];
+		u32 size = (r->x2 - r->x1) * (vga_bpp >> 3) * (r->y2 - r->y1);
+		if (size > s->savedsize[to])
+		{
+			free(s->saved[to]);
+			s->saved[to] = (u8*)malloc(size);
+			s->savedsize[to] = s->saved[to] ? size : 0;
+			if (!s->saved[to])
+				continue;
+		}
+
+		memcpy(s->saved[to], s->saved[from], size);
+		s->under[to] = *r;
+		s->drawn[to] = 1;
+		s->pending = (s->pending & ~(1 << to)) | (((s->pending >> from) & 1) << to);
+	}
+
+	sprite_pagepending = 0;
+	for (int i = 0; i < SPRITE_MAX; i++)
+		sprite_pagepending |= sprites[i].pending;
+}
@@ -9,26 +9,122 @@ extern "C"
 #include <string.h>
 #include <stdlib.h>
 #include "vga.h"
+#include "numfmt.h"
 
-#define MAXCOLS vga_width/vga_font_width
-#define MAXROWS vga_height/vga_font_height
+#define MAXCOLS (vga_width/vga_font_width)
+#define MAXROWS (vga_height/vga_font_height)
+
+// staged output is shown at least this often while a program is running
+#define TERM_FLUSH_USEC	20000
+
+// foreground and background of each attribute
+static RGBA term_pairs[TERM_MAXPAIRS][2];
+static uint32_t term_npairs;
+static uint8_t term_lastattr;
+
+// the attribute for the current colours, adding a pair the first time they
+// are used
+static uint8_t term_attr()
+{
+	RGBA fg = vga_getforecolor();
+	RGBA bg = vga_getbackcolor();
+	
+	if(term_npairs && term_pairs[term_lastattr][0] == fg && term_pairs[term_lastattr][1] == bg)
+		return term_lastattr;
+	
+	uint32_t i;
+	for(i=0; i<term_npairs; i++)
+		if(term_pairs[i][0] == fg && term_pairs[i][1] == bg)
+			break;
+	
+	if(i == TERM_MAXPAIRS)
+	{
+		// the table is full, so take a pair no cell uses any more
+		uint8_t used[TERM_MAXPAIRS];
+		memset(used, 0, sizeof(used));
+		for(uint32_t n=0; n<MAXCOLS*MAXROWS; n++)
+			used[term_attrmem[n] & ~TERM_ATTR_INVERSE] = 1;
+		
+		for(i=0; i<TERM_MAXPAIRS && used[i]; i++)
+			;
+		if(i == TERM_MAXPAIRS)
+			return term_lastattr;
+	}
+	else if(i == term_npairs)
+		term_npairs++;
+	
+	term_pairs[i][0] = fg;
+	term_pairs[i][1] = bg;
+	term_lastattr = i;
+	return i;
+}
+
+static void term_drawcell(uint32_t col, uint32_t row)
+{
+	uint32_t n = (row * MAXCOLS) + col;
+	uint8_t attr = term_attrmem[n];
+	RGBA fg = term_pairs[attr & ~TERM_ATTR_INVERSE][0];
+	RGBA bg = term_pairs[attr & ~TERM_ATTR_INVERSE][1];
+	
+	if(attr & TERM_ATTR_INVERSE)
+		vga_drawglyph(col * vga_font_width, row * vga_font_height, vga_screenmem[n], bg, fg);
+	else
+		vga_drawglyph(col * vga_font_width, row * vga_font_height, vga_screenmem[n], fg, bg);
+}
+
+// Give the hardware cursor the current font size and colour. If the firmware
+// refuses, the cursor is taken down and the software one is used from then on.
+static void term_definecursor()
+{
+	if(vga_hwcursor_define(vga_font_width, vga_font_height, term_hwcolour))
+		return;
+	
+	vga_hwcursor_move(0, 0, 0);
+	term_hwcursor = 0;
+	term_cursor_on = 0;
+}
 
 void term_init(Keyboard *keybrd)
 {
 	keyboard = keybrd;
 	
-	vga_clear();
-	
-	vga_screenmem = (uint8_t*)malloc(MAXCOLS * MAXROWS);
+	term_npairs = 0;
+	term_layout();
 
 	uint32_t cursorTimer = TimerStartKernelTimer(30, term_cursorblink_handler, 0, (void *)cursorTimer);
-	
-	for(uint8_t row=0;row<MAXROWS; row++)
-		for(uint8_t col=0;col<MAXCOLS; col++)
-			term_putcharat(col,row,32);
 		
 	term_cursor_mode = 1;
+	
+	// use the VideoCore cursor when the firmware has one
+	term_hwcolour = vga_getforecolor();
+	term_hwcursor = vga_hwcursor_define(vga_font_width, vga_font_height, term_hwcolour);
+	term_cursor_on = 0;
+}
 
+// Size the grid for the current font and start on a clear screen. Called
+// again after the font changes, since the rows and columns change with it.
+void term_layout()
+{
+	free(vga_screenmem);
+	free(term_attrmem);
+	free(term_dirtyrows);
+	
+	vga_screenmem = (uint8_t*)malloc(MAXCOLS * MAXROWS);
+	term_attrmem = (uint8_t*)malloc(MAXCOLS * MAXROWS);
+	term_dirtyrows = (uint8_t*)malloc(MAXROWS);
+	memset(term_dirtyrows, 0, MAXROWS);
+	term_scroll_pending = 0;
+	
+	vga_clear();
+	memset(vga_screenmem, 32, MAXCOLS * MAXROWS);
+	memset(term_attrmem, term_attr(), MAXCOLS * MAXROWS);
+	
+	term_row = 0;
+	term_col = 0;
+	term_cursor_on = 0;
+	
+	if(term_hwcursor)
+		term_definecursor();
 }
 
 void term_clear()
@@ -39,11 +135,9 @@ void term_clear()
 	term_col = 0;
 }
 
-void term_putchar(uint8_t c)
+// place one character on the grid and advance; the caller handles the cursor
+static void term_emit(uint8_t c)
 {
-	if(term_cursor_mode == 1)
-		term_hidecursor();
-	
 	if (c > 127)
 	{
 		switch(c)
@@ -138,6 +232,20 @@ void term_putchar(uint8_t c)
 		term_scroll();
 		term_row = MAXROWS-1;
 	}
+}
+
+static void term_emitpad(uint8_t c, int count)
+{
+	while(count-- > 0)
+		term_emit(c);
+}
+
+void term_putchar(uint8_t c)
+{
+	if(term_cursor_mode == 1)
+		term_hidecursor();
+	
+	term_emit(c);
 	
 	if(vga_cursor_mode == 1)
 		term_showcursor();
@@ -145,82 +253,258 @@ void term_putchar(uint8_t c)
 
 void term_puts(char* text)
 {
-	int ctr = 0;
-	while(text[ctr] != 0)
-	{
-		term_putchar(text[ctr]);
-		ctr++;
-	};
+	if(term_cursor_mode == 1)
+		term_hidecursor();
+	
+	while(*text)
+		term_emit(*text++);
+	
+	if(vga_cursor_mode == 1)
+		term_showcursor();
+}
+
+// Like term_puts for text that has a length rather than a terminating zero,
+// such as PRINT items. Scrolls stay staged as they do for single characters.
+void term_putn(const char* text, uint32_t len)
+{
+	if(term_cursor_mode == 1)
+		term_hidecursor();
+	
+	while(len--)
+		term_emit(*text++);
+	
+	if(vga_cursor_mode == 1)
+		term_showcursor();
 }
 
-void term_printf(char* text, ...)
+// Emit a block of text, then show it at once. Callers that batch their
+// output (LIST) use this so the screen is scrolled and drawn once per block
+// rather than once per line.
+void term_write(const char* text, uint32_t len)
+{
+	if(term_cursor_mode == 1)
+		term_hidecursor();
+	
+	while(len--)
+		term_emit(*text++);
+	
+	term_flush();
+	
+	if(vga_cursor_mode == 1)
+		term_showcursor();
+}
+
+uint32_t term_rows()
+{
+	return MAXROWS;
+}
+
+uint32_t term_cols()
+{
+	return MAXCOLS;
+}
+
+void term_printf(const char* text, ...)
 {
-	// set up variable argument list
 	va_list ap;
 	va_start(ap, text);
+	term_vprintf(text, ap);
+	va_end(ap);
+}
 
-	char res[256];
-	char* result = res;
+// Formats straight onto the grid, so there is no limit on the output length.
+// Supports the flags "-0+ #", width and precision (including '*') and the
+// conversions c d i u x X o s f F e E g G %. Length modifiers are accepted
+// and ignored since every argument here is at most 32 bits or a double.
+void term_vprintf(const char* text, va_list ap)
+{
+	char num[FMT_MAXLEN + 2];
 	
-	// scan all characters in 'text' and look for format specifiers
-	do
+	if(term_cursor_mode == 1)
+		term_hidecursor();
+	
+	while(*text)
 	{
-		if(*text == '%')
+		if(*text != '%')
+		{
+			term_emit(*text++);
+			continue;
+		}
+		text++;
+		
+		bool left = false, zero = false, plus = false, space = false, alt = false;
+		int width = 0;
+		int prec = -1;
+		
+		for(;; text++)
+		{
+			if(*text == '-') left = true;
+			else if(*text == '0') zero = true;
+			else if(*text == '+') plus = true;
+			else if(*text == ' ') space = true;
+			else if(*text == '#') alt = true;
+			else break;
+		}
+		
+		if(*text == '*')
 		{
-			if(*(text + 1) == 'c') // unsigned char
+			width = va_arg(ap, int);
+			if(width < 0)
 			{
-				*result++ = (char)va_arg(ap, unsigned int);
+				left = true;
+				width = -width;
 			}
-			else if(*(text + 1) == 'd') // integer (signed)
+			text++;
+		}
+		else
+			while(*text >= '0' && *text <= '9')
+				width = width * 10 + (*text++ - '0');
+		
+		if(*text == '.')
+		{
+			text++;
+			prec = 0;
+			if(*text == '*')
 			{
-				char buffer[10];
-				snprintf(buffer, sizeof(buffer), "%d", va_arg(ap, int));
-				char* intstr = strcpy(result,buffer);
-				
-				result += strlen(intstr);
+				prec = va_arg(ap, int);
+				text++;
 			}
-			else if(*(text + 1) == 'f') // float
+			else
+				while(*text >= '0' && *text <= '9')
+					prec = prec * 10 + (*text++ - '0');
+		}
+		
+		while(*text == 'l' || *text == 'h' || *text == 'z' || *text == 'j' || *text == 't')
+			text++;
+		
+		char conv = *text;
+		if(conv == 0)
+			break;
+		text++;
+		
+		const char* body = num;
+		int len = 0;
+		char sign = 0;
+		const char* prefix = "";
+		bool numeric = true;
+		
+		switch(conv)
+		{
+			case 'c':
 			{
-				char buffer[10];
-				snprintf(buffer, sizeof(buffer), "%f", va_arg(ap, double));
-				char* intstr = strcpy(result,buffer);
-				
-				result += strlen(intstr);
+				num[0] = (char)va_arg(ap, int);
+				len = 1;
+				numeric = false;
+				break;
 			}
-			else if(*(text + 1) == 'g') // float (trimmed)
+			case 's':
 			{
-				char buffer[10];
-				snprintf(buffer, sizeof(buffer), "%g", va_arg(ap, double));
-				char* intstr = strcpy(result,buffer);
-				
-				result += strlen(intstr);
+				body = va_arg(ap, const char*);
+				if(body == 0)
+					body = "(null)";
+				while(body[len] && (prec < 0 || len < prec))
+					len++;
+				numeric = false;
+				break;
+			}
+			case 'd':
+			case 'i':
+			{
+				int32_t v = va_arg(ap, int32_t);
+				if(v < 0)
+				{
+					sign = '-';
+					len = fmt_utoa(num, -(uint32_t)v, 10, 0);
+				}
+				else
+					len = fmt_utoa(num, v, 10, 0);
+				break;
+			}
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			{
+				uint32_t v = va_arg(ap, uint32_t);
+				unsigned base = conv == 'u' ? 10 : (conv == 'o' ? 8 : 16);
+				len = fmt_utoa(num, v, base, conv == 'X');
+				if(alt && v != 0)
+					prefix = conv == 'x' ? "0x" : (conv == 'X' ? "0X" : (conv == 'o' ? "0" : ""));
+				break;
 			}
-			else if(*(text + 1) == 's') // string
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
 			{
-				char* arg = (char*)va_arg(ap, unsigned int);
+				double v = va_arg(ap, double);
 				
-				strcpy(result,arg);
+				if(conv == 'f' || conv == 'F')
+					len = fmt_ftoa(num, v, prec);
+				else if(conv == 'e' || conv == 'E')
+					len = fmt_etoa(num, v, prec, conv == 'E');
+				else
+					len = fmt_gtoa(num, v, prec, alt);
 				
-				result += strlen(arg);
+				if(conv == 'G')
+					for(int i=0; i<len; i++)
+						if(num[i] == 'e')
+							num[i] = 'E';
+				
+				if(num[0] == '-')
+				{
+					sign = '-';
+					body++;
+					len--;
+				}
+				
+				// precision already applied to the digits
+				prec = -1;
+				break;
+			}
+			default:
+			{
+				// '%%' and anything unknown are printed as is
+				num[0] = conv;
+				len = 1;
+				numeric = false;
+				break;
 			}
-			
-			// make sure we skip the type specifier
-			text++;
-			
-			continue;
 		}
 		
-		// if we got thus far, it's probably just a normal character
-		*result++ = *text;
-	}while(*text++ != '\0');
-	
-	result += 0;
+		if(numeric && !sign)
+			sign = plus ? '+' : (space ? ' ' : 0);
+		
+		// integer precision is a minimum digit count
+		int digitpad = (numeric && prec > len) ? prec - len : 0;
+		int total = len + digitpad + (sign ? 1 : 0) + strlen(prefix);
+		int pad = width > total ? width - total : 0;
+		
+		if(!left && !(zero && numeric && prec < 0))
+			term_emitpad(' ', pad);
+		if(sign)
+			term_emit(sign);
+		for(const char* p = prefix; *p; p++)
+			term_emit(*p);
+		if(!left && zero && numeric && prec < 0)
+			term_emitpad('0', pad);
+		term_emitpad('0', digitpad);
+		for(int i=0; i<len; i++)
+			term_emit(body[i]);
+		if(left)
+			term_emitpad(' ', pad);
+	}
 	
-	term_puts(res);
+	if(vga_cursor_mode == 1)
+		term_showcursor();
 }
 
 uint8_t term_getchar()
 {
+	term_update();
+	
 	if(keyboard->CheckChanged())
 	{
 		return keyboard->GetChar();
@@ -237,8 +521,14 @@ void term_getcharat(uint8_t col, uint8_t row, uint8_t* ch)
 void term_putcharat(uint8_t col, uint8_t row, uint8_t ch)
 {
 	*(vga_screenmem + (row * MAXCOLS) + col) = ch;
+	*(term_attrmem + (row * MAXCOLS) + col) = term_attr();
 	
-	vga_drawchar(col * vga_font_width, row * vga_font_height, ch);
+	// while a scroll is staged the framebuffer lags behind the grid, so
+	// only remember the row and let term_flush() draw it
+	if(term_scroll_pending)
+		term_dirtyrows[row] = 1;
+	else
+		term_drawcell(col, row);
 }
 
 void term_rc2xy(uint8_t col, uint8_t row, uint32_t* x, uint32_t* y)
@@ -249,46 +539,137 @@ void term_rc2xy(uint8_t col, uint8_t row, uint32_t* x, uint32_t* y)
 
 void term_scroll()
 {
-	vga_scroll();
+	// scroll the grid only; the framebuffer is moved once in term_flush()
+	memmove(vga_screenmem, vga_screenmem + MAXCOLS, MAXCOLS*(MAXROWS-1));
+	memset(vga_screenmem + ((MAXROWS-1) * MAXCOLS), 32, MAXCOLS);
+	memmove(term_attrmem, term_attrmem + MAXCOLS, MAXCOLS*(MAXROWS-1));
+	memset(term_attrmem + ((MAXROWS-1) * MAXCOLS), term_attr(), MAXCOLS);
+	
+	memmove(term_dirtyrows, term_dirtyrows + 1, MAXROWS-1);
+	term_dirtyrows[MAXROWS-1] = 1;
 	
-	memcpy(vga_screenmem, vga_screenmem + (1 * MAXCOLS), MAXCOLS*(MAXROWS-1));
+	if(term_scroll_pending == 0)
+		term_stage_start = read32(ARM_SYSTIMER_CLO);
 	
-	for(uint8_t c=0;c<MAXCOLS;c++)
-		*(vga_screenmem + ((MAXROWS-1) * MAXCOLS) + c) = 32;
+	if(term_scroll_pending < MAXROWS)
+		term_scroll_pending++;
 }
 
+void term_flush()
+{
+	if(term_scroll_pending == 0)
+		return;
+	
+	uint32_t lines = term_scroll_pending;
+	uint8_t blank = term_attr();
+	
+	// once the whole screen has scrolled this just clears it
+	vga_scroll(lines);
+	term_scroll_pending = 0;
+	
+	for(uint32_t row=0; row<MAXROWS; row++)
+	{
+		if(!term_dirtyrows[row])
+			continue;
+		
+		// rows scrolled in by vga_scroll() are already blank
+		bool cleared = row >= MAXROWS - lines;
+		uint8_t* cells = vga_screenmem + (row * MAXCOLS);
+		uint8_t* attrs = term_attrmem + (row * MAXCOLS);
+		
+		for(uint32_t col=0; col<MAXCOLS; col++)
+		{
+			if(cleared && cells[col] == 32 && attrs[col] == blank)
+				continue;
+			term_drawcell(col, row);
+		}
+		
+		term_dirtyrows[row] = 0;
+	}
+	
+	if(term_cursor_mode == 1)
+		term_showcursor();
+}
+
+void term_update()
+{
+	if(term_scroll_pending && (read32(ARM_SYSTIMER_CLO) - term_stage_start) >= TERM_FLUSH_USEC)
+		term_flush();
+	
+	if(term_blink_pending)
+	{
+		term_blink_pending = 0;
+		term_toggle_cursor();
+	}
+}
+
+// The hardware cursor sits above the framebuffer, so output never has to
+// lift it; it is only told about a move. Otherwise the cursor is the cell
+// under it with its colours swapped.
 void term_showcursor()
 {
-	uint8_t c;
-	term_getcharat(term_col, term_row, &c);
+	// the cursor is drawn by term_flush() once the staged output is shown
+	if(term_scroll_pending)
+		return;
+	
+	if(term_hwcursor && vga_getforecolor() != term_hwcolour)
+	{
+		term_hwcolour = vga_getforecolor();
+		term_definecursor();
+	}
 	
-	vga_swapcolors();	
-	term_putcharat(term_col, term_row, c);
-	vga_swapcolors();
+	if(term_hwcursor)
+	{
+		if(!term_cursor_on || term_hwcol != term_col || term_hwrow != term_row)
+		{
+			vga_hwcursor_move(1, term_col * vga_font_width, term_row * vga_font_height);
+			term_hwcol = term_col;
+			term_hwrow = term_row;
+		}
+		
+		term_cursor_on = 1;
+		return;
+	}
+	
+	*(term_attrmem + (term_row * MAXCOLS) + term_col) |= TERM_ATTR_INVERSE;
+	term_drawcell(term_col, term_row);
 	
 	term_cursor_on = 1;
 }
 
 void term_hidecursor()
 {
-	uint8_t c;
-	term_getcharat(term_col, term_row, &c);
-	term_putcharat(term_col, term_row, c);
+	if(term_hwcursor)
+		return;
+	
+	*(term_attrmem + (term_row * MAXCOLS) + term_col) &= ~TERM_ATTR_INVERSE;
+	
+	if(term_scroll_pending)
+		term_dirtyrows[term_row] = 1;
+	else
+		term_drawcell(term_col, term_row);
 	
 	term_cursor_on = 0;
 }
 
 void term_toggle_cursor()
 {
-	if(term_cursor_on)
+	if(term_hwcursor && term_cursor_on)
+	{
+		vga_hwcursor_move(0, term_hwcol * vga_font_width, term_hwrow * vga_font_height);
+		term_cursor_on = 0;
+	}
+	else if(term_cursor_on)
 		term_hidecursor();
 	else
 		term_showcursor();
 }
 
+// runs in the timer interrupt, so only note that a blink is due and leave the
+// drawing to term_update()
 void term_cursorblink_handler(unsigned hTimer, void *pParam, void *pContext)
 {
-	term_toggle_cursor();
+	term_blink_pending = 1;
 	uint32_t cursorTimer = TimerStartKernelTimer(30, term_cursorblink_handler, 0, (void *)cursorTimer);
 }
 
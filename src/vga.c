@@ -1,55 +1,207 @@
 #include "vga.h"
+#include "rpi-hardware.h"
 
 
-void vga_init(u32 widthDesired, u32 heightDesired, u32 colourDepth)
+// the Commodore 64 palette, indexed by COLOR
+const RGBA vga_colours[16] =
 {
-	/*if (widthDesired < 320)
-		widthDesired = 320;
-	if (heightDesired < 240)
-		heightDesired = 240;
-	if (widthDesired > 1024)
-		widthDesired = 1024;
-	if (heightDesired > 720)
-		heightDesired = 720;*/
+	RGBA(0x00, 0x00, 0x00, 0xff),	// black
+	RGBA(0xff, 0xff, 0xff, 0xff),	// white
+	RGBA(0x88, 0x39, 0x32, 0xff),	// red
+	RGBA(0x67, 0xb6, 0xbd, 0xff),	// cyan
+	RGBA(0x8b, 0x3f, 0x96, 0xff),	// purple
+	RGBA(0x55, 0xa0, 0x49, 0xff),	// green
+	RGBA(0x40, 0x31, 0x8d, 0xff),	// blue
+	RGBA(0xbf, 0xce, 0x72, 0xff),	// yellow
+	RGBA(0x8b, 0x54, 0x29, 0xff),	// orange
+	RGBA(0x57, 0x42, 0x00, 0xff),	// brown
+	RGBA(0xb8, 0x69, 0x62, 0xff),	// light red
+	RGBA(0x50, 0x50, 0x50, 0xff),	// dark grey
+	RGBA(0x78, 0x78, 0x78, 0xff),	// grey
+	RGBA(0x94, 0xe0, 0x89, 0xff),	// light green
+	RGBA(0x78, 0x69, 0xc4, 0xff),	// light blue
+	RGBA(0x9f, 0x9f, 0x9f, 0xff)	// light grey
+};
 
-	vga_framebuffer = 0;
-	rpi_mailbox_property_t* mp;
+static void vga_glyphflush();
 
-	vga_scaleX = (float)widthDesired / 1024.0f;
-	vga_scaleY = (float)heightDesired / 768.0f;
+static u32 vga_buffersize;						// both pages
+static int vga_cachemode = MEM_ATTR_WRITECOMBINE;
+
+// Palette for 8bpp modes. Colours made with VGA_INDEXED refer to an entry
+// here at every depth, so COLOR and PALETTE mean the same thing in all modes;
+// only at 8bpp does changing an entry recolour what is already on screen.
+static RGBA vga_palette[256];
+static int vga_paletteready;
+
+// recent nearest-entry lookups for true colours at 8bpp
+static RGBA vga_nearestkey[4];
+static u8 vga_nearestval[4];
+static u32 vga_nearestnext;
+
+static inline RGBA vga_rgb(RGBA color)
+{
+	return ALPHA(color) ? color : vga_palette[RED(color)];
+}
+
+static void vga_defaultpalette()
+{
+	u32 n = 0;
+
+	// the C64 colours, then a 6x6x6 colour cube and a grey ramp
+	for (; n < 16; n++)
+		vga_palette[n] = vga_colours[n];
+	for (u32 r = 0; r < 6; r++)
+		for (u32 g = 0; g < 6; g++)
+			for (u32 b = 0; b < 6; b++)
+				vga_palette[n++] = RGBA(r * 51, g * 51, b * 51, 0xff);
+	for (u32 i = 0; n < 256; i++)
+		vga_palette[n++] = RGBA(8 + (i * 10), 8 + (i * 10), 8 + (i * 10), 0xff);
+
+	vga_paletteready = 1;
+}
+
+static void vga_uploadpalette(u32 first, u32 count)
+{
+	static int buffer[2 + 256];
+
+	if (vga_bpp != 8)
+		return;
+
+	buffer[0] = first;
+	buffer[1] = count;
+	for (u32 i = 0; i < count; i++)
+		buffer[2 + i] = vga_palette[first + i] | 0xff000000;
+
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_SET_PALETTE, buffer);
+	RPI_PropertyProcess();
+}
+
+static u8 vga_nearest(RGBA color)
+{
+	for (u32 i = 0; i < 4; i++)
+		if (vga_nearestkey[i] == color)
+			return vga_nearestval[i];
 
-	do
+	u32 best = 0, bestdist = 0xffffffff;
+	for (u32 i = 0; i < 256; i++)
 	{
-		RPI_PropertyInit();
-		RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER);
-		RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, widthDesired, heightDesired);
-		RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, widthDesired, heightDesired);
-		RPI_PropertyAddTag(TAG_SET_DEPTH, colourDepth);
-		RPI_PropertyAddTag(TAG_GET_PITCH);
-		RPI_PropertyAddTag(TAG_GET_PHYSICAL_SIZE);
-		RPI_PropertyAddTag(TAG_GET_DEPTH);
-		RPI_PropertyProcess();
+		int dr = RED(color) - RED(vga_palette[i]);
+		int dg = GREEN(color) - GREEN(vga_palette[i]);
+		int db = BLUE(color) - BLUE(vga_palette[i]);
+		u32 dist = (dr * dr) + (dg * dg) + (db * db);
 
-		if ((mp = RPI_PropertyGet(TAG_GET_PHYSICAL_SIZE)))
+		if (dist < bestdist)
 		{
-			vga_width = mp->data.buffer_32[0];
-			vga_height = mp->data.buffer_32[1];
+			best = i;
+			bestdist = dist;
+			if (dist == 0)
+				break;
 		}
+	}
+
+	vga_nearestkey[vga_nearestnext] = color;
+	vga_nearestval[vga_nearestnext] = best;
+	vga_nearestnext = (vga_nearestnext + 1) & 3;
+	return best;
+}
+
+void vga_setpalette(u32 first, u32 count, const RGBA *colours)
+{
+	if (first > 255 || count > 256 - first)
+		return;
 
-		if ((mp = RPI_PropertyGet(TAG_GET_DEPTH)))
-			vga_bpp = mp->data.buffer_32[0];
+	for (u32 i = 0; i < count; i++)
+		vga_palette[first + i] = colours[i] | 0xff000000;
 
-		if ((mp = RPI_PropertyGet(TAG_GET_PITCH)))
-			vga_pitch = mp->data.buffer_32[0];
+	memset(vga_nearestkey, 0, sizeof(vga_nearestkey));
+	vga_uploadpalette(first, count);
+}
+
+RGBA vga_getpalette(u32 n)
+{
+	return vga_palette[n & 255];
+}
 
-		if ((mp = RPI_PropertyGet(TAG_ALLOCATE_BUFFER)))
-			vga_framebuffer = (unsigned char*)(mp->data.buffer_32[0] & 0x3FFFFFFF);
+// Shift entries first..last along by steps, wrapping round. At 8bpp this
+// animates everything drawn in those entries without touching the pixels.
+void vga_rotatepalette(u32 first, u32 last, int steps)
+{
+	RGBA tmp[256];
+	u32 count = last - first + 1;
+
+	if (first > last || last > 255)
+		return;
+
+	steps %= (int)count;
+	if (steps < 0)
+		steps += count;
+
+	for (u32 i = 0; i < count; i++)
+		tmp[(i + steps) % count] = vga_palette[first + i];
+	memcpy(&vga_palette[first], tmp, count * sizeof(RGBA));
+
+	memset(vga_nearestkey, 0, sizeof(vga_nearestkey));
+	vga_uploadpalette(first, count);
+}
+
+// One allocation attempt; returns 0 when the firmware gave no buffer
+static int vga_allocate(u32 widthDesired, u32 heightDesired, u32 colourDepth)
+{
+	rpi_mailbox_property_t* mp;
+	u32 virtualHeight = 0;
+
+	vga_framebuffer = 0;
+
+	// ask for two pages stacked vertically so SCREEN 2 can flip between them
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER);
+	RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, widthDesired, heightDesired);
+	RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, widthDesired, heightDesired * 2);
+	RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, 0);
+	RPI_PropertyAddTag(TAG_SET_DEPTH, colourDepth);
+	RPI_PropertyAddTag(TAG_GET_PITCH);
+	RPI_PropertyAddTag(TAG_GET_PHYSICAL_SIZE);
+	RPI_PropertyAddTag(TAG_GET_VIRTUAL_SIZE);
+	RPI_PropertyAddTag(TAG_GET_DEPTH);
+	RPI_PropertyProcess();
+
+	if ((mp = RPI_PropertyGet(TAG_GET_PHYSICAL_SIZE)))
+	{
+		vga_width = mp->data.buffer_32[0];
+		vga_height = mp->data.buffer_32[1];
 	}
-	while (vga_framebuffer == 0);
 
-	//RPI_PropertyInit();
-	//RPI_PropertyAddTag(TAG_SET_PALETTE, palette);
-	//RPI_PropertyProcess();
+	if ((mp = RPI_PropertyGet(TAG_GET_VIRTUAL_SIZE)))
+		virtualHeight = mp->data.buffer_32[1];
+
+	if ((mp = RPI_PropertyGet(TAG_GET_DEPTH)))
+		vga_bpp = mp->data.buffer_32[0];
+
+	if ((mp = RPI_PropertyGet(TAG_GET_PITCH)))
+		vga_pitch = mp->data.buffer_32[0];
+
+	if ((mp = RPI_PropertyGet(TAG_ALLOCATE_BUFFER)))
+		vga_framebuffer = (unsigned char*)(mp->data.buffer_32[0] & 0x3FFFFFFF);
+
+	if (vga_framebuffer == 0)
+		return 0;
+
+	vga_pages[0] = vga_framebuffer;
+	vga_pages[1] = virtualHeight >= vga_height * 2 ? vga_framebuffer + (vga_height * vga_pitch) : 0;
+	vga_pagecount = 1;
+	vga_visiblepage = 0;
+
+	vga_buffersize = (vga_pages[1] ? 2 : 1) * vga_height * vga_pitch;
+	// the MMU setup already maps everything from UNCACHED_MEM_BASE up, where
+	// the firmware puts the framebuffer, as write-combined (0x01C02)
+	if (vga_cachemode != MEM_ATTR_WRITECOMBINE)
+		set_section_attr((u32)vga_framebuffer, vga_buffersize, vga_cachemode);
+
+	if (!vga_paletteready)
+		vga_defaultpalette();
+	vga_uploadpalette(0, 256);
 
 	switch (vga_bpp)
 	{
@@ -67,17 +219,194 @@ void vga_init(u32 widthDesired, u32 heightDesired, u32 colourDepth)
 			vga_plotpixelFn = vga_plotpixel8;
 		break;
 	}
+
+	return 1;
+}
+
+void vga_init(u32 widthDesired, u32 heightDesired, u32 colourDepth)
+{
+	/*if (widthDesired < 320)
+		widthDesired = 320;
+	if (heightDesired < 240)
+		heightDesired = 240;
+	if (widthDesired > 1024)
+		widthDesired = 1024;
+	if (heightDesired > 720)
+		heightDesired = 720;*/
+
+	vga_scaleX = (float)widthDesired / 1024.0f;
+	vga_scaleY = (float)heightDesired / 768.0f;
+
+	while (!vga_allocate(widthDesired, heightDesired, colourDepth))
+		;
 }
 
 void vga_release()
 {
+	// wait for the answer, the buffer may be asked for again straight away
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_RELEASE_BUFFER, vga_framebuffer);
+	RPI_PropertyProcess();
+
 	vga_framebuffer = 0;
+	vga_pages[0] = 0;
+	vga_pages[1] = 0;
+	vga_pagecount = 1;
+	vga_visiblepage = 0;
+}
+
+// Change mode at run time. The old buffer goes back to the firmware first,
+// so if the new mode is refused the old one is set up again and 0 returned.
+int vga_setmode(u32 width, u32 height, u32 depth)
+{
+	u32 oldwidth = vga_width;
+	u32 oldheight = vga_height;
+	u32 olddepth = vga_bpp;
+
+	if (width < VGA_MINWIDTH || width > VGA_MAXWIDTH || height < VGA_MINHEIGHT || height > VGA_MAXHEIGHT)
+		return 0;
+	if (depth != 8 && depth != 16 && depth != 24 && depth != 32)
+		return 0;
+
+	vga_release();
+
+	// cached glyphs are in the old pixel format
+	vga_glyphflush();
+
+	if (vga_allocate(width, height, depth))
+	{
+		vga_scaleX = (float)vga_width / 1024.0f;
+		vga_scaleY = (float)vga_height / 768.0f;
+		return 1;
+	}
+
+	vga_init(oldwidth, oldheight, olddepth);
+	return 0;
+}
+
+// Map the framebuffer with one of the MEM_ATTR_ types. Write combining is
+// the default; with write back nothing is seen until the range is cleaned, so
+// that is only for measuring.
+void vga_setcache(int attr)
+{
+	vga_cachemode = attr;
+	set_section_attr((u32)vga_pages[0], vga_buffersize, attr);
+}
+
+// Time full-page fills and one-row scrolls with the framebuffer mapped as
+// attr, in MB/s. Scrolling counts the bytes copied. Leaves the page cleared.
+void vga_bandwidth(int attr, u32 *fill, u32 *scroll)
+{
+	int oldmode = vga_cachemode;
+	u32 bytes = vga_height * vga_pitch;
+	u32 start, elapsed;
+
+	vga_setcache(attr);
 
+	start = read32(ARM_SYSTIMER_CLO);
+	for (u32 pass = 0; pass < VGA_BENCHPASSES; pass++)
+	{
+		u32 pixel = vga_pixelvalue(vga_colours[pass & 15]);
+		for (u32 y = 0; y < vga_height; y++)
+			vga_fillspan(0, vga_width - 1, y, pixel);
+	}
+	if (attr == MEM_ATTR_WRITEBACK)
+		clean_dcache_range(vga_framebuffer, bytes);
+	elapsed = read32(ARM_SYSTIMER_CLO) - start;
+	*fill = elapsed ? (u32)(((uint64_t)bytes * VGA_BENCHPASSES) / elapsed) : 0;
+
+	start = read32(ARM_SYSTIMER_CLO);
+	for (u32 pass = 0; pass < VGA_BENCHPASSES; pass++)
+		vga_scroll(1);
+	if (attr == MEM_ATTR_WRITEBACK)
+		clean_dcache_range(vga_framebuffer, bytes);
+	elapsed = read32(ARM_SYSTIMER_CLO) - start;
+	bytes -= vga_font_height * vga_pitch;
+	*scroll = elapsed ? (u32)(((uint64_t)bytes * VGA_BENCHPASSES) / elapsed) : 0;
+
+	vga_setcache(oldmode);
+	vga_clear();
+}
+
+// 1 draws straight to the visible page; 2 draws to the hidden one until vga_flip
+int vga_setpages(u32 pages)
+{
+	if (pages == 2)
+	{
+		if (vga_pages[1] == 0)
+			return 0;
+
+		if (vga_pagecount != 2)
+		{
+			// start the back page from what is on screen
+			u8 *back = vga_pages[vga_visiblepage ^ 1];
+			memcpy(back, vga_pages[vga_visiblepage], vga_height * vga_pitch);
+			vga_framebuffer = back;
+		}
+	}
+	else
+		vga_framebuffer = vga_pages[vga_visiblepage];
+
+	vga_pagecount = pages == 2 ? 2 : 1;
+	return 1;
+}
+
+void vga_flip(int vsync)
+{
+	if (vga_pagecount != 2)
+		return;
+
+	vga_visiblepage ^= 1;
+
+	// the wait comes after the offset change, so the old page is off screen on return
 	RPI_PropertyInit();
-	RPI_PropertyAddTag(TAG_RELEASE_BUFFER, vga_framebuffer);
-	RPI_PropertyProcessNoCheck();
+	RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, vga_visiblepage * vga_height);
+	if (vsync)
+		RPI_PropertyAddTag(TAG_SET_VSYNC, 0);
+	RPI_PropertyProcess();
+
+	vga_framebuffer = vga_pages[vga_visiblepage ^ 1];
 }
 
+// The cursor image is an underline in ARGB, transparent elsewhere. The
+// firmware reads it when the cursor is defined, so one buffer will do.
+static u32 vga_cursorimage[VGA_CURSORMAX * VGA_CURSORMAX] __attribute__((aligned(16)));
+
+int vga_hwcursor_define(u32 w, u32 h, RGBA color)
+{
+	rpi_mailbox_property_t *mp;
+	RGBA rgb = vga_rgb(color);
+	u32 argb = 0xff000000 | (RED(rgb) << 16) | (GREEN(rgb) << 8) | BLUE(rgb);
+	u32 line = h >= 8 ? h / 4 : 1;
+
+	if (w > VGA_CURSORMAX || h > VGA_CURSORMAX)
+		return 0;
+
+	for (u32 y = 0; y < h; y++)
+		for (u32 x = 0; x < w; x++)
+			vga_cursorimage[(y * w) + x] = y >= h - line ? argb : 0;
+
+	// the firmware reads the image through the uncached alias
+	clean_dcache_range(vga_cursorimage, w * h * 4);
+
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_SET_CURSOR_INFO, w, h, (u32)vga_cursorimage | 0xC0000000, 0, 0);
+	RPI_PropertyProcess();
+
+	// firmware without a cursor leaves the tag unanswered, with no length,
+	// and one that refuses the image answers with a non-zero status
+	mp = RPI_PropertyGet(TAG_SET_CURSOR_INFO);
+	return mp && mp->byte_length >= 4 && mp->data.buffer_32[0] == 0;
+}
+
+// x,y is the top left of the cursor on the visible page, in framebuffer
+// pixels, which the firmware scales to the display
+void vga_hwcursor_move(int on, u32 x, u32 y)
+{
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_SET_CURSOR_STATE, on ? 1 : 0, x, y, 1);
+	RPI_PropertyProcess();
+}
 
 void vga_setforecolor(RGBA color)
 {
@@ -89,6 +418,16 @@ void vga_setbackcolor(RGBA color)
 	vga_current_bg_color = color;
 }
 
+RGBA vga_getforecolor()
+{
+	return vga_current_fg_color;
+}
+
+RGBA vga_getbackcolor()
+{
+	return vga_current_bg_color;
+}
+
 void vga_cursor_on()
 {
 	vga_cursor_mode = 1;
@@ -101,34 +440,144 @@ void vga_cursor_off()
 
 void vga_plotpixel32(u32 pixel_offset)
 {
-	*((volatile RGBA*)&vga_framebuffer[pixel_offset]) = vga_current_fg_color;
+	*((volatile RGBA*)&vga_framebuffer[pixel_offset]) = vga_rgb(vga_current_fg_color);
 }
 
 void vga_plotpixel24(u32 pixel_offset)
 {
-	vga_framebuffer[pixel_offset++] = BLUE(vga_current_fg_color);
-	vga_framebuffer[pixel_offset++] = GREEN(vga_current_fg_color);
-	vga_framebuffer[pixel_offset++] = RED(vga_current_fg_color);
+	RGBA color = vga_rgb(vga_current_fg_color);
+
+	vga_framebuffer[pixel_offset++] = BLUE(color);
+	vga_framebuffer[pixel_offset++] = GREEN(color);
+	vga_framebuffer[pixel_offset++] = RED(color);
 }
 
 void vga_plotpixel16(u32 pixel_offset)
 {
-	*(unsigned short*)&vga_framebuffer[pixel_offset] = ((RED(vga_current_fg_color) >> 3) << 11) | ((GREEN(vga_current_fg_color) >> 2) << 5) | (BLUE(vga_current_fg_color) >> 3);
+	RGBA color = vga_rgb(vga_current_fg_color);
+
+	*(unsigned short*)&vga_framebuffer[pixel_offset] = ((RED(color) >> 3) << 11) | ((GREEN(color) >> 2) << 5) | (BLUE(color) >> 3);
 }
 
 void vga_plotpixel8(u32 pixel_offset)
 {
-	vga_framebuffer[pixel_offset++] = RED(vga_current_fg_color);
+	vga_framebuffer[pixel_offset++] = vga_pixelvalue(vga_current_fg_color);
 }
 
 void vga_plotpixel(u32 x, u32 y)
 {
-	if (x < 0 || y < 0 || x >= vga_width || y >= vga_height)
+	// negative coordinates wrap to large unsigned values, so this also rejects them
+	if (x >= vga_width || y >= vga_height)
 		return;
 	int pixel_offset = (x * (vga_bpp >> 3)) + (y * vga_pitch);
 	(*vga_plotpixelFn)(pixel_offset);
 }
 
+u32 vga_pixelvalue(RGBA color)
+{
+	if (vga_bpp == 8)
+		return ALPHA(color) ? vga_nearest(color) : RED(color);
+
+	color = vga_rgb(color);
+	switch (vga_bpp)
+	{
+		case 32:
+			return color;
+		case 24:
+			return (BLUE(color) << 16) | (GREEN(color) << 8) | RED(color);
+		default:
+			return ((RED(color) >> 3) << 11) | ((GREEN(color) >> 2) << 5) | (BLUE(color) >> 3);
+	}
+}
+
+static inline void vga_storepixel(u8 *dst, u32 pixel)
+{
+	switch (vga_bpp)
+	{
+		case 32:
+			*(volatile u32*)dst = pixel;
+			break;
+		case 24:
+			dst[0] = pixel >> 16;
+			dst[1] = pixel >> 8;
+			dst[2] = pixel;
+			break;
+		case 8:
+			*dst = pixel;
+			break;
+		default:
+			*(u16*)dst = pixel;
+			break;
+	}
+}
+
+// fill x1..x2 inclusive on row y; the caller has already clipped
+void vga_fillspan(int x1, int x2, int y, u32 pixel)
+{
+	u8 *dst = &vga_framebuffer[(x1 * (vga_bpp >> 3)) + (y * vga_pitch)];
+	int count = x2 - x1 + 1;
+
+	switch (vga_bpp)
+	{
+		case 32:
+		{
+			u32 *p = (u32*)dst;
+			while (count--)
+				*p++ = pixel;
+			break;
+		}
+		case 24:
+		{
+			while (count--)
+			{
+				*dst++ = pixel >> 16;
+				*dst++ = pixel >> 8;
+				*dst++ = pixel;
+			}
+			break;
+		}
+		case 8:
+		{
+			memset(dst, pixel, count);
+			break;
+		}
+		default:
+		{
+			u16 *p = (u16*)dst;
+
+			// pair up pixels for word stores once aligned
+			if (((u32)p & 2) && count)
+			{
+				*p++ = pixel;
+				count--;
+			}
+			u32 pair = (pixel & 0xffff) | (pixel << 16);
+			u32 *w = (u32*)p;
+			while (count >= 2)
+			{
+				*w++ = pair;
+				count -= 2;
+			}
+			if (count)
+				*(u16*)w = pixel;
+			break;
+		}
+	}
+}
+
+// clip a span to the screen and fill it
+static void vga_clipspan(int x1, int x2, int y, u32 pixel)
+{
+	if (y < 0 || y >= (int)vga_height)
+		return;
+	if (x1 < 0)
+		x1 = 0;
+	if (x2 >= (int)vga_width)
+		x2 = vga_width - 1;
+	if (x1 <= x2)
+		vga_fillspan(x1, x2, y, pixel);
+}
+
 void vga_clear()
 {
 	vga_cleararea(0, 0, vga_width, vga_height);
@@ -143,65 +592,210 @@ void vga_swapcolors()
 
 void vga_cleararea(u32 x1, u32 y1, u32 x2, u32 y2)
 {
-	u32 tmp_color = vga_current_fg_color;
-	vga_current_fg_color = vga_current_bg_color;
-	
-	vga_cliprect(x1, y1, x2, y2);
+	int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
 
-	for (u32 y = y1; y < y2; y++)
-	{
-		u32 line = y * vga_pitch;
-		for (u32 x = x1; x < x2; x++)
-		{
-			u32 pixel_offset = (x * (vga_bpp >> 3)) + line;
-			(*vga_plotpixelFn)(pixel_offset);
-		}
-	}
-	
-	vga_current_fg_color = tmp_color;
+	if (!vga_cliprect(&cx1, &cy1, &cx2, &cy2))
+		return;
+
+	u32 pixel = vga_pixelvalue(vga_current_bg_color);
+	for (int y = cy1; y < cy2; y++)
+		vga_fillspan(cx1, cx2 - 1, y, pixel);
 }
 
-void vga_scroll()
+void vga_scroll(u32 lines)
 {
 	u8 *fb = vga_framebuffer;
-	int line_byte_width = vga_width * (vga_bpp >> 3);
+	u32 line_byte_width = vga_width * (vga_bpp >> 3);
+	u32 pixel_rows = lines * vga_font_height;
 
-	for(int line = 0; line < (vga_height - vga_font_height); line++)
-		memcpy(&fb[line * vga_pitch], &fb[(line + vga_font_height) * vga_pitch], line_byte_width);
+	if (pixel_rows >= vga_height)
+	{
+		vga_clear();
+		return;
+	}
+
+	// rows are contiguous when there is no padding, so move them in one go
+	if (vga_pitch == line_byte_width)
+		memmove(fb, &fb[pixel_rows * vga_pitch], (vga_height - pixel_rows) * vga_pitch);
+	else
+		for (u32 line = 0; line < (vga_height - pixel_rows); line++)
+			memcpy(&fb[line * vga_pitch], &fb[(line + pixel_rows) * vga_pitch], line_byte_width);
 	
-	vga_cleararea(0,vga_height-vga_font_height,vga_width,vga_height);
+	vga_cleararea(0, vga_height - pixel_rows, vga_width, vga_height);
 }
 
 
 
-void vga_drawchar(u32 x, u32 y, unsigned char c)
+struct vga_font
 {
-	u32 fontHeight;
-	const unsigned char* fontBitMap;
+	const uint8_t *bitmap;		// 8 pixels wide, one byte per row
+	u32 height;
+	u32 glyphs;
+};
 
-	fontBitMap = vga_current_font;
-	fontHeight = vga_font_height;
+static const struct vga_font vga_fonts[VGA_FONTS] =
+{
+	{ font8x8_basic, 8, 128 },
+	{ avpriv_vga16_font, 16, 256 }
+};
 
-	vga_cleararea(x,y,x+vga_font_width,y+vga_font_height);
-	
-	for (u32 py = 0; py < fontHeight; ++py)
+int vga_setfont(u32 font, u32 scale)
+{
+	if (font >= VGA_FONTS || scale < 1 || scale > VGA_FONTSCALE)
+		return 0;
+
+	vga_current_font = vga_fonts[font].bitmap;
+	vga_font_glyphs = vga_fonts[font].glyphs;
+	vga_font_scale = scale;
+	vga_font_width = 8 * scale;
+	vga_font_height = vga_fonts[font].height * scale;
+
+	vga_glyphflush();
+	return 1;
+}
+
+// Pre-rendered glyphs for the most recently used colour pairs. Each set holds
+// every glyph of the font as opaque pixels in framebuffer format, rendered the
+// first time it is drawn, so a character is a memcpy per row whatever colours
+// it uses.
+struct vga_glyphset
+{
+	u8 *pixels;
+	u32 fg, bg, bpp;
+	u32 used;
+	u32 ready[VGA_GLYPHS / 32];
+};
+
+static struct vga_glyphset vga_glyphsets[VGA_GLYPHSETS];
+static u32 vga_glyphclock;
+static u32 vga_glyphlast;
+
+static struct vga_glyphset *vga_findglyphs(u32 fg, u32 bg)
+{
+	struct vga_glyphset *set = &vga_glyphsets[vga_glyphlast];
+
+	if (set->pixels && set->fg == fg && set->bg == bg && set->bpp == vga_bpp)
 	{
-		if (y + py > vga_height)
-			return;
+		set->used = ++vga_glyphclock;
+		return set;
+	}
 
-		unsigned char b = fontBitMap[c * fontHeight + py];
-		int yoffs = (y + py) * vga_pitch;
-		for (int px = 0; px < 8; ++px)
+	// look for the pair, remembering the least recently used set on the way
+	u32 victim = 0;
+	for (u32 i = 0; i < VGA_GLYPHSETS; i++)
+	{
+		set = &vga_glyphsets[i];
+		if (set->pixels && set->fg == fg && set->bg == bg && set->bpp == vga_bpp)
 		{
-			if (x + px >= vga_width)
-				continue;
+			vga_glyphlast = i;
+			set->used = ++vga_glyphclock;
+			return set;
+		}
+		if (set->used < vga_glyphsets[victim].used)
+			victim = i;
+	}
 
-			int pixel_offset = ((px + x) * (vga_bpp >> 3)) + yoffs;
-			if ((b & 0x80) == 0x80)
-				(*vga_plotpixelFn)(pixel_offset);
-			b = b << 1;
+	set = &vga_glyphsets[victim];
+	if (!set->pixels)
+	{
+		// sized for 32bpp so a set can be reused whatever the depth
+		set->pixels = (u8*)malloc(vga_font_glyphs * vga_font_width * vga_font_height * 4);
+		if (!set->pixels)
+			return 0;
+	}
+
+	set->fg = fg;
+	set->bg = bg;
+	set->bpp = vga_bpp;
+	set->used = ++vga_glyphclock;
+	memset(set->ready, 0, sizeof(set->ready));
+	vga_glyphlast = victim;
+
+	return set;
+}
+
+// the glyph sizes change with the font, so every set is dropped
+static void vga_glyphflush()
+{
+	for (u32 i = 0; i < VGA_GLYPHSETS; i++)
+	{
+		free(vga_glyphsets[i].pixels);
+		vga_glyphsets[i].pixels = 0;
+		vga_glyphsets[i].used = 0;
+	}
+	vga_glyphlast = 0;
+}
+
+static u8 *vga_glyph(struct vga_glyphset *set, unsigned char c)
+{
+	u32 bytes = vga_bpp >> 3;
+	u32 rowbytes = vga_font_width * bytes;
+	u32 rows = vga_font_height / vga_font_scale;
+	u8 *glyph = &set->pixels[c * rowbytes * vga_font_height];
+
+	if (set->ready[c >> 5] & (1u << (c & 31)))
+		return glyph;
+
+	// render each font row once at full width, then repeat it for the scale
+	u8 *dst = glyph;
+	for (u32 row = 0; row < rows; row++)
+	{
+		unsigned char b = vga_current_font[c * rows + row];
+		u8 *line = dst;
+
+		for (u32 px = 0; px < 8; px++, b <<= 1)
+			for (u32 i = 0; i < vga_font_scale; i++)
+			{
+				vga_storepixel(dst, (b & 0x80) ? set->fg : set->bg);
+				dst += bytes;
+			}
+
+		for (u32 i = 1; i < vga_font_scale; i++)
+		{
+			memcpy(dst, line, rowbytes);
+			dst += rowbytes;
 		}
 	}
+
+	set->ready[c >> 5] |= 1u << (c & 31);
+	return glyph;
+}
+
+void vga_drawglyph(u32 x, u32 y, unsigned char c, RGBA fg, RGBA bg)
+{
+	u32 bytes = vga_bpp >> 3;
+
+	if (x >= vga_width || y >= vga_height)
+		return;
+	if (c >= vga_font_glyphs)
+		c = ' ';
+
+	struct vga_glyphset *set = vga_findglyphs(vga_pixelvalue(fg), vga_pixelvalue(bg));
+	if (!set)
+		return;
+	u8 *src = vga_glyph(set, c);
+
+	u32 w = vga_font_width;
+	u32 h = vga_font_height;
+	if (x + w > vga_width)
+		w = vga_width - x;
+	if (y + h > vga_height)
+		h = vga_height - y;
+
+	u32 srcpitch = vga_font_width * bytes;
+	u8 *dst = &vga_framebuffer[(x * bytes) + (y * vga_pitch)];
+
+	for (u32 py = 0; py < h; py++)
+	{
+		memcpy(dst, src, w * bytes);
+		dst += vga_pitch;
+		src += srcpitch;
+	}
+}
+
+void vga_drawchar(u32 x, u32 y, unsigned char c)
+{
+	vga_drawglyph(x, y, c, vga_current_fg_color, vga_current_bg_color);
 }
 
 u32 vga_drawtext(u32 x, u32 y, char *ptr)
@@ -218,7 +812,6 @@ u32 vga_drawtext(u32 x, u32 y, char *ptr)
 		char c = *ptr++;
 		if ((c != '\r') && (c != '\n'))
 		{
-			vga_cleararea(xCursor, yCursor, xCursor + vga_font_width, yCursor + fontHeight);
 			vga_drawchar(xCursor, yCursor, c);
 			
 			xCursor += vga_font_width;
@@ -236,7 +829,7 @@ u32 vga_drawtext(u32 x, u32 y, char *ptr)
 void vga_drawcursor(u32 x, u32 y)
 {
 	y++;
-	for(int y2=0;y2<vga_font_height-1;y2++)
+	for(u32 y2=0;y2<vga_font_height-1;y2++)
 		vga_drawline(x+1, y+y2, x+vga_font_width-1,y+y2);
 }
 
@@ -245,76 +838,461 @@ void vga_erasecursor(u32 x, u32 y)
 	vga_cleararea(x, y, x + vga_font_width, y + vga_font_height);
 }
 
-void vga_drawline(u32 x1, u32 y1, u32 x2, u32 y2)
+#define CLIP_LEFT	1
+#define CLIP_RIGHT	2
+#define CLIP_TOP	4
+#define CLIP_BOTTOM	8
+
+static int vga_outcode(int x, int y)
 {
-	vga_cliprect(x1, y1, x2, y2);
+	int code = 0;
+
+	if (x < 0)
+		code |= CLIP_LEFT;
+	else if (x >= (int)vga_width)
+		code |= CLIP_RIGHT;
+	if (y < 0)
+		code |= CLIP_TOP;
+	else if (y >= (int)vga_height)
+		code |= CLIP_BOTTOM;
+
+	return code;
+}
+
+static inline int vga_ceildiv(long long a, long long b)
+{
+	return (int)((a + b - 1) / b);
+}
+
+void vga_drawline(int x1, int y1, int x2, int y2)
+{
+	int code1 = vga_outcode(x1, y1);
+	int code2 = vga_outcode(x2, y2);
+
+	// trivially outside
+	if (code1 & code2)
+		return;
+
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+
+	if (y1 == y2)
+	{
+		vga_clipspan(x1 < x2 ? x1 : x2, x1 < x2 ? x2 : x1, y1, pixel);
+		return;
+	}
+
+	// Bresenham along the major axis u, minor axis v
+	int bytes = vga_bpp >> 3;
+	int dx = x2 - x1, sx = 1;
+	int dy = y2 - y1, sy = 1;
 
-	int dx0, dy0, ox, oy, eulerMax;
-	dx0 = (int)(x2 - x1);
-	dy0 = (int)(y2 - y1);
-	eulerMax = abs(dx0);
-	if (abs(dy0) > eulerMax) eulerMax = abs(dy0);
-	for (int i = 0; i <= eulerMax; i++)
+	if (dx < 0)
 	{
-		ox = ((dx0 * i) / eulerMax) + x1;
-		oy = ((dy0 * i) / eulerMax) + y1;
-		int pixel_offset = (ox * (vga_bpp >> 3)) + (oy * vga_pitch);
-		(*vga_plotpixelFn)(pixel_offset);
+		dx = -dx;
+		sx = -1;
+	}
+	if (dy < 0)
+	{
+		dy = -dy;
+		sy = -1;
+	}
+
+	int du, dv, u1, v1, su, sv, umax, vmax, ustep, vstep;
+	if (dx >= dy)
+	{
+		du = dx; dv = dy; u1 = x1; v1 = y1; su = sx; sv = sy;
+		umax = vga_width - 1; vmax = vga_height - 1;
+		ustep = sx * bytes; vstep = sy * (int)vga_pitch;
+	}
+	else
+	{
+		du = dy; dv = dx; u1 = y1; v1 = x1; su = sy; sv = sx;
+		umax = vga_height - 1; vmax = vga_width - 1;
+		ustep = sy * (int)vga_pitch; vstep = sx * bytes;
+	}
+
+	// Step i plots v offset m(i) = floor((2*dv*i + du - 1) / (2*du)). If an end is
+	// off screen, solve for the range of steps that stays on, so the clipped line
+	// keeps exactly the pixels of the unclipped one.
+	int first = 0, last = du;
+	if (code1 | code2)
+	{
+		int lo, hi;
+
+		if (su > 0)
+		{
+			if (-u1 > first) first = -u1;
+			if (umax - u1 < last) last = umax - u1;
+		}
+		else
+		{
+			if (u1 - umax > first) first = u1 - umax;
+			if (u1 < last) last = u1;
+		}
+
+		lo = sv > 0 ? -v1 : v1 - vmax;
+		hi = sv > 0 ? vmax - v1 : v1;
+
+		if (dv == 0)
+		{
+			if (lo > 0 || hi < 0)
+				return;
+		}
+		else
+		{
+			if (lo > 0)
+			{
+				int i = vga_ceildiv(2LL * du * lo - du + 1, 2LL * dv);
+				if (i > first) first = i;
+			}
+			if (hi < dv)
+			{
+				if (hi < 0)
+					return;
+				int i = vga_ceildiv(2LL * du * (hi + 1) - du + 1, 2LL * dv) - 1;
+				if (i < last) last = i;
+			}
+		}
+
+		if (first > last)
+			return;
+	}
+
+	int m = (int)((2LL * dv * first + du - 1) / (2LL * du));
+	int err = 2 * dv - du + 2 * dv * first - 2 * du * m;
+	int u = u1 + su * first;
+	int v = v1 + sv * m;
+	u8 *dst = dx >= dy ? &vga_framebuffer[(u * bytes) + (v * vga_pitch)] : &vga_framebuffer[(v * bytes) + (u * vga_pitch)];
+
+	for (int i = first; i <= last; i++)
+	{
+		vga_storepixel(dst, pixel);
+		if (err > 0)
+		{
+			dst += vstep;
+			err -= 2 * du;
+		}
+		dst += ustep;
+		err += 2 * dv;
 	}
 }
 
 void vga_drawlinev(u32 x, u32 y1, u32 y2)
 {
-	vga_cliprect(x, y1, x, y2);
-	for (u32 y = y1; y <= y2; ++y)
+	vga_drawline(x, y1, x, y2);
+}
+
+void vga_drawrect(int x0, int y0, int w, int h) 
+{
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+
+	vga_clipspan(x0, x0 + w, y0, pixel); // top
+	vga_clipspan(x0, x0 + w, y0 + h, pixel); // bottom
+	vga_drawline(x0, y0, x0, y0 + h); // left
+	vga_drawline(x0 + w, y0, x0 + w, y0 + h); // right
+}
+
+void vga_fillrect(int x0, int y0, int w, int h)
+{
+	int x1 = x0, y1 = y0, x2 = x0 + w + 1, y2 = y0 + h + 1;
+
+	if (!vga_cliprect(&x1, &y1, &x2, &y2))
+		return;
+
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+	for (int y = y1; y < y2; y++)
+		vga_fillspan(x1, x2 - 1, y, pixel);
+}
+
+static inline void vga_plotclipped(int x, int y, u32 pixel)
+{
+	if ((u32)x < vga_width && (u32)y < vga_height)
+		vga_storepixel(&vga_framebuffer[(x * (vga_bpp >> 3)) + (y * vga_pitch)], pixel);
+}
+
+void vga_drawcircle(int x0, int y0, int r)
+{
+	int x = r;
+	int y = 0;
+	int radiusError = 1 - x;
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+
+	if (r < 0)
+		return;
+
+	while (x >= y)
 	{
-		int pixel_offset = (x * (vga_bpp >> 3)) + (y * vga_pitch);
-		(*vga_plotpixelFn)(pixel_offset);
+		vga_plotclipped(x0 - y, y0 - x, pixel); // top left
+		vga_plotclipped(x0 + y, y0 - x, pixel); // top right
+		vga_plotclipped(x0 - x, y0 - y, pixel); // upper middle left
+		vga_plotclipped(x0 + x, y0 - y, pixel); // upper middle right
+		vga_plotclipped(x0 - x, y0 + y, pixel); // lower middle left
+		vga_plotclipped(x0 + x, y0 + y, pixel); // lower middle right
+		vga_plotclipped(x0 - y, y0 + x, pixel); // bottom left
+		vga_plotclipped(x0 + y, y0 + x, pixel); // bottom right
+
+		y++;
+		if (radiusError < 0)
+			radiusError += 2 * y + 1;
+		else
+		{
+			x--;
+			radiusError += 2 * (y - x + 1);
+		}
 	}
 }
 
-void vga_drawrect(u32 x0, u32 y0, u32 w, u32 h) 
+void vga_fillcircle(int x0, int y0, int r)
 {
-    vga_drawline(x0, y0, x0 + w, y0); // top
-    vga_drawline(x0, y0, x0, y0 + h); // left
-    vga_drawline(x0, y0 + h, x0 + w, y0 + h); // bottom
-    vga_drawline(x0 + w, y0, x0 + w, y0 + h); // right
+	int x = r;
+	int y = 0;
+	int radiusError = 1 - x;
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+
+	if (r < 0)
+		return;
+
+	// same walk as vga_drawcircle, joining each mirrored pair with a span
+	while (x >= y)
+	{
+		vga_clipspan(x0 - x, x0 + x, y0 + y, pixel);
+		if (y != 0)
+			vga_clipspan(x0 - x, x0 + x, y0 - y, pixel);
+
+		y++;
+		if (radiusError < 0)
+			radiusError += 2 * y + 1;
+		else
+		{
+			// the outer rows only change when x steps in
+			if (x >= y)
+			{
+				vga_clipspan(x0 - (y - 1), x0 + (y - 1), y0 + x, pixel);
+				vga_clipspan(x0 - (y - 1), x0 + (y - 1), y0 - x, pixel);
+			}
+			x--;
+			radiusError += 2 * (y - x + 1);
+		}
+	}
+}
+
+// raw framebuffer value at x,y, or 0xffffffff off screen (which 32bpp white
+// also reads as)
+u32 vga_getpixel(int x, int y)
+{
+	if ((u32)x >= vga_width || (u32)y >= vga_height)
+		return 0xffffffff;
+
+	u8 *src = &vga_framebuffer[(x * (vga_bpp >> 3)) + (y * vga_pitch)];
+	switch (vga_bpp)
+	{
+		case 32:
+			return *(volatile u32*)src;
+		case 24:
+			return (src[0] << 16) | (src[1] << 8) | src[2];
+		case 8:
+			return *src;
+		default:
+			return *(u16*)src;
+	}
+}
+
+struct vga_fillseg
+{
+	short y, xl, xr, dy;
+};
+
+static struct vga_fillseg vga_fillstack[VGA_FILLSTACK];
+
+// Span flood fill (Heckbert's seed fill). Each stack entry is a run on the
+// line above or below that still has to be scanned; the stack is fixed size,
+// so a pathological shape stops early and 0 is returned.
+int vga_floodfill(int x, int y)
+{
+	struct vga_fillseg *sp = vga_fillstack;
+	struct vga_fillseg *end = vga_fillstack + VGA_FILLSTACK;
+	u32 fill = vga_pixelvalue(vga_current_fg_color);
+	u32 old = vga_getpixel(x, y);
+	int xmax = vga_width - 1;
+	int ymax = vga_height - 1;
+	int overflow = 0;
+	int x1, x2, dy, l;
+
+	// a white pixel at 32bpp reads as 0xffffffff too, so check the seed itself
+	if ((u32)x >= vga_width || (u32)y >= vga_height || old == fill)
+		return 1;
+
+#define FILL_PUSH(Y, XL, XR, DY) do { \
+		if ((Y) + (DY) >= 0 && (Y) + (DY) <= ymax) { \
+			if (sp < end) { sp->y = (Y); sp->xl = (XL); sp->xr = (XR); sp->dy = (DY); sp++; } \
+			else overflow = 1; \
+		} } while (0)
+
+	FILL_PUSH(y, x, x, 1);
+	FILL_PUSH(y + 1, x, x, -1);
+
+	while (sp > vga_fillstack)
+	{
+		sp--;
+		dy = sp->dy;
+		y = sp->y + dy;
+		x1 = sp->xl;
+		x2 = sp->xr;
+
+		x = x1;
+		if (vga_getpixel(x, y) == old)
+		{
+			// extend the run left past where the parent line started
+			while (x > 0 && vga_getpixel(x - 1, y) == old)
+				x--;
+			l = x;
+			if (l < x1)
+				FILL_PUSH(y, l, x1 - 1, -dy);
+			x = x1 + 1;
+		}
+		else
+		{
+			// find the first open pixel under the parent run
+			for (x++; x <= x2 && vga_getpixel(x, y) != old; x++);
+			l = x;
+			if (x > x2)
+				continue;
+		}
+
+		do
+		{
+			while (x <= xmax && vga_getpixel(x, y) == old)
+				x++;
+			vga_fillspan(l, x - 1, y, fill);
+			FILL_PUSH(y, l, x - 1, dy);
+			if (x > x2 + 1)
+				FILL_PUSH(y, x2 + 1, x - 1, -dy);
+
+			for (x++; x <= x2 && vga_getpixel(x, y) != old; x++);
+			l = x;
+		}
+		while (x <= x2);
+	}
+
+#undef FILL_PUSH
+
+	return !overflow;
 }
 
-void vga_drawcircle(u32 x0, u32 y0, u32 r)
+struct vga_polyedge
 {
-    u32 x = r;
-    u32 y = 0;
-    u32 radiusError = 1 - x;
+	int ymin, ymax;
+	int x;		// 16.16 at the current scanline
+	int dxdy;	// 16.16
+};
 
-    while(x >= y)
-    {
-        // top left
-        vga_plotpixel(-y + x0, -x + y0);
-        // top right
-        vga_plotpixel(y + x0, -x + y0);
-        // upper middle left
-        vga_plotpixel(-x + x0, -y + y0);
-        // upper middle right
-        vga_plotpixel(x + x0, -y + y0);
-        // lower middle left
-        vga_plotpixel(-x + x0, y + y0);
-        // lower middle right
-        vga_plotpixel(x + x0, y + y0);
-        // bottom left
-        vga_plotpixel(-y + x0, x + y0);
-        // bottom right
-        vga_plotpixel(y + x0, x + y0);
+static struct vga_polyedge vga_polyedges[VGA_MAXPOLY];
+static struct vga_polyedge *vga_polyactive[VGA_MAXPOLY];
 
-        y++;
-        if (radiusError < 0)
-        {
-            radiusError += 2 * y + 1;
-        } else {
-            x--;
-            radiusError+= 2 * (y - x + 1);
-        }
-    }
+// Edge table scanline fill of a closed polygon given as x,y pairs. Pixels whose
+// centre is inside are filled, one span per pair of crossings; the outline is
+// then stroked so the edges themselves are included like vga_fillrect.
+void vga_fillpoly(const int *xy, int n)
+{
+	int edges = 0, active = 0, next = 0;
+	int ytop = 0x7fffffff, ybottom = -0x7fffffff;
+	u32 pixel = vga_pixelvalue(vga_current_fg_color);
+
+	if (n < 3)
+		return;
+	if (n > VGA_MAXPOLY)
+		n = VGA_MAXPOLY;
+
+	for (int i = 0; i < n; i++)
+	{
+		int j = (i + 1) % n;
+		int xa = xy[i * 2], ya = xy[i * 2 + 1];
+		int xb = xy[j * 2], yb = xy[j * 2 + 1];
+
+		// keep 16.16 in range
+		xa = xa < -16384 ? -16384 : (xa > 16383 ? 16383 : xa);
+		xb = xb < -16384 ? -16384 : (xb > 16383 ? 16383 : xb);
+
+		if (ya == yb)
+			continue;
+		if (ya > yb)
+		{
+			int t = xa; xa = xb; xb = t;
+			t = ya; ya = yb; yb = t;
+		}
+
+		struct vga_polyedge e;
+		e.ymin = ya;
+		e.ymax = yb;
+		e.dxdy = (int)((long long)(xb - xa) * 65536 / (yb - ya));
+		e.x = xa * 65536;
+
+		// insertion sort on ymin
+		int k = edges++;
+		while (k > 0 && vga_polyedges[k - 1].ymin > e.ymin)
+		{
+			vga_polyedges[k] = vga_polyedges[k - 1];
+			k--;
+		}
+		vga_polyedges[k] = e;
+
+		if (ya < ytop) ytop = ya;
+		if (yb > ybottom) ybottom = yb;
+	}
+
+	if (ytop < 0)
+		ytop = 0;
+	if (ybottom > (int)vga_height)
+		ybottom = vga_height;
+
+	for (int y = ytop; y < ybottom; y++)
+	{
+		// edges spanning [ymin, ymax) enter the active list, stepped to this line
+		while (next < edges && vga_polyedges[next].ymin <= y)
+		{
+			struct vga_polyedge *e = &vga_polyedges[next++];
+			if (e->ymax <= y)
+				continue;
+			e->x += (int)((long long)(y - e->ymin) * e->dxdy);
+			vga_polyactive[active++] = e;
+		}
+
+		// drop finished edges
+		int kept = 0;
+		for (int i = 0; i < active; i++)
+			if (vga_polyactive[i]->ymax > y)
+				vga_polyactive[kept++] = vga_polyactive[i];
+		active = kept;
+
+		// crossings stay nearly sorted between lines, so insertion sort is cheap
+		for (int i = 1; i < active; i++)
+		{
+			struct vga_polyedge *e = vga_polyactive[i];
+			int k = i;
+			while (k > 0 && vga_polyactive[k - 1]->x > e->x)
+			{
+				vga_polyactive[k] = vga_polyactive[k - 1];
+				k--;
+			}
+			vga_polyactive[k] = e;
+		}
+
+		for (int i = 0; i + 1 < active; i += 2)
+		{
+			int xl = (vga_polyactive[i]->x + 0xffff) >> 16;
+			int xr = ((vga_polyactive[i + 1]->x + 0xffff) >> 16) - 1;
+			vga_clipspan(xl, xr, y, pixel);
+		}
+
+		for (int i = 0; i < active; i++)
+			vga_polyactive[i]->x += vga_polyactive[i]->dxdy;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		int j = (i + 1) % n;
+		vga_drawline(xy[i * 2], xy[i * 2 + 1], xy[j * 2], xy[j * 2 + 1]);
+	}
 }
 
 /*void vga_plotimage(u32* image, int x, int y, int w, int h)
@@ -337,11 +1315,13 @@ void vga_drawcircle(u32 x0, u32 y0, u32 r)
 	vga_current_fg_color = tempcolor;
 }*/
 
-void vga_cliprect(u32 x1, u32 y1, u32 x2, u32 y2)
+// clamp a half-open rectangle to the screen, returns 0 if nothing is left
+int vga_cliprect(int *x1, int *y1, int *x2, int *y2)
 {
-	if (x1 > vga_width) x1 = vga_width;
-	if (y1 > vga_height) y1 = vga_height;
-	if (x2 > vga_width) x2 = vga_width;
-	if (y2 > vga_height) y2 = vga_height;
-}
+	if (*x1 < 0) *x1 = 0;
+	if (*y1 < 0) *y1 = 0;
+	if (*x2 > (int)vga_width) *x2 = vga_width;
+	if (*y2 > (int)vga_height) *y2 = vga_height;
 
+	return *x1 < *x2 && *y1 < *y2;
+}
\ No newline at end of file